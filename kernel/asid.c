@@ -0,0 +1,134 @@
+// Address-space identifiers.
+//
+// Each process gets a pair of ASIDs: p->asid for its kernel
+// page table, which also maps its user pages (see kvmmirror()),
+// and p->asid+1 for its user page table. They are
+// put in satp along with the page tables, so that switching
+// page tables, in the scheduler and in trampoline.S, does not
+// have to flush the TLB: entries of other address spaces stay
+// in it, but do not match. Kernel mappings that are the same
+// in every page table are marked PTE_G and shared by all
+// ASIDs. kernel_pagetable uses ASID 0, which is never handed
+// out.
+//
+// When a process changes or removes many mappings at once,
+// instead of flushing them from every hart, asid_invalidate()
+// just takes its ASIDs away; the process gets fresh ones the
+// next time it runs, and the stale entries can never match
+// again. p->cpumask records the harts that have run p since it
+// got its ASIDs, for tlb_flush() to flush a few pages on.
+//
+// ASIDs are handed out in increasing order; when they run out,
+// a new generation starts: every process has to get new ASIDs,
+// and every hart flushes its whole TLB before it uses one of
+// the new generation.
+//
+// If the hardware has no ASIDs, every switch flushes the TLB.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+extern pagetable_t kernel_pagetable;
+
+struct {
+  struct spinlock lock;
+  uint64 gen;     // current generation; 0 is never current
+  uint next;      // next free ASID of this generation
+  uint n;         // ASIDs the hardware has; 0 if it has none
+} asid;
+
+// Find out how many ASIDs the hardware supports.
+// Called by hart 0 once it has paging on.
+void
+asidinit(void)
+{
+  uint64 bits;
+
+  initlock(&asid.lock, "asid");
+  // the ASID bits that are implemented stick.
+  w_satp(MAKE_SATP_ASID(kernel_pagetable, SATP_ASID_MASK));
+  bits = (r_satp() >> SATP_ASID_SHIFT) & SATP_ASID_MASK;
+  w_satp(MAKE_SATP(kernel_pagetable));
+  sfence_vma();
+  // 0 and 1 are not handed out, so at least one pair more.
+  asid.n = bits + 1 >= 4 ? bits + 1 : 0;
+  asid.gen = 1;
+  asid.next = 2;
+}
+
+// Make sure p's ASIDs are of the current generation, and that
+// this hart's TLB holds no entries of an earlier generation,
+// before p's page tables are installed.
+// Called with interrupts off, by the scheduler or by p itself.
+void
+asid_activate(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  uint64 gen;
+
+  if(asid.n == 0){
+    // the hart that ran p before flushed when it switched away.
+    sfence_vma();
+    p->cpumask = 1L << cpuid();
+    return;
+  }
+
+  gen = __atomic_load_n(&asid.gen, __ATOMIC_ACQUIRE);
+  if(p->asidgen != gen){
+    acquire(&asid.lock);
+    if(asid.next + 2 > asid.n){
+      // out of ASIDs: start a new generation.
+      asid.gen++;
+      asid.next = 2;
+    }
+    p->asid = asid.next;
+    asid.next += 2;
+    p->asidgen = gen = asid.gen;
+    p->cpumask = 0;
+    release(&asid.lock);
+  }
+  if(c->asidgen != gen){
+    sfence_vma();
+    c->asidgen = gen;
+  }
+  __atomic_fetch_or(&p->cpumask, 1L << cpuid(), __ATOMIC_RELAXED);
+}
+
+// The current generation, for tlb_flush() to tell whether a
+// process's ASIDs are still in use.
+uint64
+asid_gen(void)
+{
+  return __atomic_load_n(&asid.gen, __ATOMIC_ACQUIRE);
+}
+
+// Whether the hardware lacks ASIDs, so that every change
+// of satp must flush the TLB.
+int
+asid_none(void)
+{
+  return asid.n == 0;
+}
+
+// Take p's ASIDs away, after changing or removing mappings
+// in its page tables, so that no hart can still be holding
+// TLB entries that p will use. p must be the current process,
+// or not running. The current process's kernel page table,
+// which mirrors its user pages, switches to the new ASID at
+// once.
+void
+asid_invalidate(struct proc *p)
+{
+  p->asidgen = 0;
+  if(p == myproc() && p->kpagetable){
+    push_off();
+    asid_activate(p);
+    w_satp(MAKE_SATP_ASID(p->kpagetable, p->asid));
+    pop_off();
+  }
+}
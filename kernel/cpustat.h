@@ -0,0 +1,17 @@
+// Counters for one hart, as returned by cpustat().
+struct cpustat {
+  uint64 nshootdown;   // TLB shootdowns started here that sent IPIs
+  uint64 nipisent;     // shootdown IPIs sent to other harts
+  uint64 nipirecv;     // shootdown requests done for other harts
+  uint64 npageflush;   // pages flushed from this hart's TLB by page
+  uint64 nasidflush;   // flushes done by giving a process new ASIDs
+  uint64 waittime;     // timer cycles spent waiting for other harts
+  uint64 nsteal;       // processes taken from other harts' run queues
+  uint64 ntimerintr;   // timer interrupts taken
+  uint64 nidle;        // times gone idle with the tick off
+  uint64 nidlewake;    // interrupts that ended a wait in wfi
+  uint64 idletime;     // timer cycles spent idle
+  uint64 nkick;        // IPIs sent from here to wake idle harts
+  uint64 nwakeup;      // woken processes run here
+  uint64 wakelat;      // timer cycles they waited from wakeup to running
+};
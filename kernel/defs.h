@@ -2,13 +2,24 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
+struct vma;
 struct pipe;
 struct proc;
 struct spinlock;
+struct tlbbatch;
+struct timeout;
 struct sleeplock;
 struct stat;
 struct superblock;
 
+// asid.c
+void            asidinit(void);
+void            asid_activate(struct proc*);
+void            asid_invalidate(struct proc*);
+int             asid_none(void);
+uint64          asid_gen(void);
+
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
@@ -60,10 +71,22 @@ void            ramdiskintr(void);
 void            ramdiskrw(struct buf*);
 
 // kalloc.c
-void*           kalloc(void);
+void*           kalloc(int);
+void*           kalloc_zeroed(int);
+void            kref(void *);
+int             krefcount(void *);
+int             kzero_idle(void);
+void            kzerod(void);
 void            kfree(void *);
 void            kinit(void);
+void*           kalloc_order(int, int);
+int             kfree_order(void *, int);
+void            ksplit(void *, int);
 uint64          get_free_mem(void);
+uint64          get_used_pages(void);
+void            get_tag_pages(uint64*);
+uint64          get_zpool_pages(void);
+uint64          get_total_pages(void);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -72,11 +95,28 @@ void            begin_op(void);
 void            end_op(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
 
+// vma.c
+int             vma_add(struct vma*, uint64, uint64, int, int, struct inode*, uint64, uint64);
+struct vma*     vma_find(struct vma*, uint64);
+struct vma*     vma_overlap(struct vma*, uint64, uint64);
+uint64          vma_mmap(struct proc*, uint64, int, int, struct inode*, uint64);
+int             vma_unmap(struct proc*, uint64, uint64);
+void            vma_dup(struct vma*, struct vma*);
+void            vma_free(struct vma*);
+int             vma_fault(pagetable_t, struct vma*, uint64, int);
+
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint, void (*)(void*));
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+
 // printf.c
 void            printf(char*, ...);
 void            panic(char*) __attribute__((noreturn));
@@ -91,6 +131,8 @@ void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
+int             setpriority(int, int);
+int             getpriority(int);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
 struct cpu*     mycpu(void);
@@ -100,26 +142,46 @@ void            procinit(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
+int             sleep_timeout(void*, struct spinlock*, uint);
 void            userinit(void);
+void            kthread_create(char*, void (*)(void));
 int             wait(uint64);
 void            wakeup(void*);
+int             wakeup_one(void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 uint64          get_proc_num(void);
 void            proc_freekpagetable(pagetable_t pt, uint64 kstack);
+int             cpustat_copyout(uint64, int);
+
+// runq.c
+void            runqinit(void);
+void            setrunnable(struct proc*);
+struct proc*    runq_take(void);
+int             runq_tick(struct proc*);
+void            runq_clock(uint, uint);
+int             runq_len(int);
+int             settickets(struct proc*, int);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// uaccess.S
+int             uaccess_copy(char*, char*, uint64);
+int             uaccess_strnlen(char*, uint64);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
+int             tryacquire(struct spinlock*);
 void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+void            lockstat_register(struct spinlock*);
+int             lockstat_copyout(uint64, int);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
@@ -127,6 +189,9 @@ void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// start.c
+int             timertick(void);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -136,6 +201,23 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// reclaim.c
+void            shrinker_register(char*, int, int (*)(int));
+int             shrink(int);
+void            kreclaim_wake(void);
+void            kreclaimd(void);
+
+// swap.c
+void            swapinit(int, struct superblock*);
+int             swapout(void);
+int             swapin(pte_t*);
+void            swapdup(uint);
+void            swapfree(uint);
+void            swapreserve(int);
+void            swapstat(uint64*, uint64*);
+void            swapspace(uint64*, uint64*);
+void*           kalloc_user(int);
+
 // syscall.c
 void            argint(int, int*);
 int             argstr(int, char*, int);
@@ -144,12 +226,36 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// tlb.c
+void            tlb_begin(struct tlbbatch*, struct proc*);
+void            tlb_add(struct tlbbatch*, uint64);
+void            tlb_flush(struct tlbbatch*);
+void            tlb_service(void);
+
+// timer.c
+void            ticksinit(void);
+uint            timer_ticks(void);
+void            timerintr(void);
+int             idle_pick(int);
+int             idle_kick(int);
+void            timer_idle(void);
+int             timer_work(void);
+void            timer_busy(int);
+
+// timeout.c
+void            timeout_init(struct timeout*, void (*)(struct timeout*), void*);
+void            timeout_add(struct timeout*, uint);
+int             timeout_del(struct timeout*);
+void            timeout_run(uint);
+uint            timeout_next(void);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+void            clockintr(void);
 
 // uart.c
 void            uartinit(void);
@@ -162,17 +268,32 @@ int             uartgetc(void);
 pagetable_t     kvmmake(void);
 void            kvminit(void);
 void            kvminithart(void);
+void            kvmswitch(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
+int             kmappages(pagetable_t, uint64, uint64, uint64, int);
+int             kvmprivate(pagetable_t, uint64, int);
+pagetable_t     kvmcreate(void);
+void            kvmfree(pagetable_t);
+void            kvmunmirror(pagetable_t);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopyrange(pagetable_t, pagetable_t, uint64, uint64, int);
+int             uvmcow(pagetable_t, uint64);
+int             uvmfault(struct proc*, uint64, int);
+uint64          uvmhugepages(void);
+#define FAULT_READ  0   // kinds of access, for uvmfault()
+#define FAULT_WRITE 1
+#define FAULT_EXEC  2
+void            uvmprefault(uint64, uint64, int);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         walk_level(pagetable_t, uint64, int *, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
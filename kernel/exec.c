@@ -6,8 +6,7 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
-
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
+#include "fcntl.h"
 
 int flags2perm(int flags)
 {
@@ -44,9 +43,12 @@ exec(char *path, char **argv)
   struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
+  struct vma segs[NVMA];
 
   // pte_t *pte, *kpte;
 
+  memset(segs, 0, sizeof(segs));
+
   begin_op();
 
   if((ip = namei(path)) == 0){
@@ -67,13 +69,14 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
-  //根据inode和elf程序头表偏移量, 按段读取程序
+  // Record the program's segments. Their pages are read
+  // from ip on first touch; see vma.c.
+  //根据inode和elf程序头表偏移量, 记录每个段，段的页面在第一次访问时才读入
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     //读取段的程序头表项
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
-    if(ph.type != ELF_PROG_LOAD)
+    if(ph.type != ELF_PROG_LOAD || ph.memsz == 0)
       continue;
     if(ph.memsz < ph.filesz)
       goto bad;
@@ -81,18 +84,18 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
-      goto bad;
+    uint64 sz1 = ph.vaddr + ph.memsz;
 
     // my code
-    if(sz1 >= PLIC) {
+    if(sz1 >= MAXUVA) {
       goto bad;
     }
 
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(vma_add(segs, ph.vaddr, PGROUNDUP(sz1), PTE_R|PTE_U|flags2perm(ph.flags),
+               MAP_PRIVATE, ip, ph.off, ph.filesz) < 0)
       goto bad;
+    if(sz1 > sz)
+      sz = sz1;
   }
   iunlockput(ip);
   end_op();
@@ -155,12 +158,17 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  // Write back and drop the old image's mappings first.
+  vma_unmap(p, 0, MAXUVA);
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
+  kvmunmirror(p->kpagetable);
+  asid_invalidate(p);
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
   proc_freepagetable(oldpagetable, oldsz);
+  memmove(p->vma, segs, sizeof(segs));
 
   // 打印init的页表 （lab pagetable）
   if(p->pid==1) vmprint(p->pagetable, 0);
@@ -174,30 +182,6 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  vma_free(segs);
   return -1;
 }
-
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
-{
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
-  }
-  
-  return 0;
-}
@@ -14,15 +14,19 @@
 #include "proc.h"
 
 struct devsw devsw[NDEV];
+// File structures come from filecache; ftable.lock
+// protects their reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
 } ftable;
 
+static struct kmem_cache *filecache;
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  filecache = kmem_cache_create("file", sizeof(struct file), 0);
 }
 
 // Allocate a file structure.
@@ -31,16 +35,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmem_cache_alloc(filecache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,9 +68,8 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  kmem_cache_free(filecache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -118,6 +116,10 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
+    // fault in the buffer first: filling a page from a file
+    // must not happen while holding f->ip's lock.
+    if(n > 0)
+      uvmprefault(addr, n, 1);
     ilock(f->ip);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
@@ -159,6 +161,7 @@ filewrite(struct file *f, uint64 addr, int n)
       if(n1 > max)
         n1 = max;
 
+      uvmprefault(addr + i, n1, 0);
       begin_op();
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
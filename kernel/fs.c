@@ -44,6 +44,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  swapinit(dev, &sb);
 }
 
 // Zero a block.
@@ -164,33 +165,100 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// In-memory inodes are allocated from inodecache and found
+// through a hash table on (dev, inum). When the last
+// reference is dropped, a valid inode stays cached on an LRU
+// list so a later iget() can find it without reading the
+// disk; at most NINODE such unreferenced inodes are kept, the
+// least recently used being freed first.
+//
+// The itable.lock spin-lock protects the hash table and the
+// LRU list. Since ip->ref indicates whether an inode is in
+// use, and ip->dev and ip->inum indicate which i-node it
+// holds, one must hold itable.lock while using any of those
+// fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 61
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  struct inode lru;   // unreferenced inodes, most recently used first
+  int nlru;
 } itable;
 
+static struct kmem_cache *inodecache;
+
+static void
+inodector(void *o)
+{
+  initsleeplock(&((struct inode*)o)->lock, "inode");
+}
+
+static int inode_shrink(int);
+
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  itable.lru.lnext = itable.lru.lprev = &itable.lru;
+  inodecache = kmem_cache_create("inode", sizeof(struct inode), inodector);
+  shrinker_register("inode", 1, inode_shrink);
+}
+
+static void
+ihash_remove(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &itable.hash[IHASH(ip->dev, ip->inum)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == ip){
+      *pp = ip->hnext;
+      return;
+    }
   }
+  panic("ihash_remove");
+}
+
+static void
+ilru_remove(struct inode *ip)
+{
+  ip->lprev->lnext = ip->lnext;
+  ip->lnext->lprev = ip->lprev;
+  itable.nlru--;
 }
 
 static struct inode* iget(uint dev, uint inum);
 
+// Shrinker: free up to npages pages' worth of the unreferenced
+// inodes on the LRU list. iget() allocates inodes, and so may
+// call kalloc(), with itable.lock held, so skip if it is busy.
+// The objects go back to inodecache, whose pages the slab
+// shrinker, which runs next, can then free; so this returns 0.
+static int
+inode_shrink(int npages)
+{
+  struct inode *ip;
+  int n;
+
+  if(!tryacquire(&itable.lock))
+    return 0;
+  n = npages * (PGSIZE / sizeof(struct inode));
+  while(n-- > 0 && itable.nlru > 0){
+    ip = itable.lru.lprev;
+    ilru_remove(ip);
+    ihash_remove(ip);
+    kmem_cache_free(inodecache, ip);
+  }
+  release(&itable.lock);
+  return 0;
+}
+
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode,
@@ -246,31 +314,37 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  int h = IHASH(dev, inum);
 
   acquire(&itable.lock);
 
-  // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  // Is the inode already cached?
+  for(ip = itable.hash[h]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        ilru_remove(ip);
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Allocate a new inode, or recycle the least recently
+  // used unreferenced one.
+  if((ip = kmem_cache_alloc(inodecache)) == 0){
+    if(itable.nlru == 0)
+      panic("iget: no inodes");
+    ip = itable.lru.lprev;
+    ilru_remove(ip);
+    ihash_remove(ip);
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = itable.hash[h];
+  itable.hash[h] = ip;
   release(&itable.lock);
 
   return ip;
@@ -327,8 +401,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode stays cached on
+// the LRU list, or is freed if it holds nothing worth keeping.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -357,7 +431,23 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0){
+    if(ip->valid == 0){
+      ihash_remove(ip);
+      kmem_cache_free(inodecache, ip);
+    } else {
+      ip->lnext = itable.lru.lnext;
+      ip->lprev = &itable.lru;
+      itable.lru.lnext->lprev = ip;
+      itable.lru.lnext = ip;
+      if(++itable.nlru > NINODE){
+        ip = itable.lru.lprev;
+        ilru_remove(ip);
+        ihash_remove(ip);
+        kmem_cache_free(inodecache, ip);
+      }
+    }
+  }
   release(&itable.lock);
 }
 
@@ -1,40 +1,141 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers.
+//
+// Free memory is managed by a binary buddy allocator that
+// hands out physically contiguous blocks of 2^order pages,
+// up to 2^MAXORDER pages (2 MiB), and coalesces freed blocks
+// with their buddies. kalloc_order()/kfree_order() use it
+// directly.
+//
+// Single pages, by far the most common request, go through
+// a per-CPU cache in front of the buddy allocator so kalloc()
+// and kfree() on different harts do not contend. kfree()
+// returns a page to the freeing CPU's list; kalloc() takes
+// from the local list, refills it with a batch from the buddy
+// allocator when it is empty, and only steals a batch from
+// another CPU's list when the buddy allocator is empty too.
+//
+// Each CPU also counts the pages it has handed out minus the
+// pages freed on it, so the amount of free memory can be read
+// in constant time without taking any lock. Allocations carry
+// a tag (KM_USER, KM_PAGETABLE, ...; see sysinfo.h) naming
+// what the memory is for, and the counts are also kept per
+// tag, for sysinfo_ext().
+//
+// Pages can be shared, e.g. by copy-on-write fork: each page
+// handed out by kalloc() has a reference count, kref() adds a
+// reference, and kfree() only frees the page when the last
+// reference is dropped.
+//
+// kalloc_zeroed() hands out pages from a pool that the kzerod
+// kernel thread zeroes ahead of time, while a hart has nothing
+// else to do. Pages in the pool still count as free.
+//
+// When everything is empty, kalloc() runs the shrinkers (see
+// reclaim.c), starting with the zeroed pool's, which gives its
+// pages back to the buddy allocator, before it gives up.
+// Filling pages with junk on kalloc() and kfree() is a debug
+// option (KALLOC_JUNK).
 
 #include "types.h"
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "sysinfo.h"
 #include "defs.h"
 
 void freerange(void *pa_start, void *pa_end);
+static int zpool_shrink(int npages);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+// pages moved between a CPU's list and the buddy allocator
+// or another CPU's list at once.
+#define PCP_BATCH 32
+// a CPU's list is trimmed by PCP_BATCH pages when it grows past this.
+#define PCP_HIGH  (4*PCP_BATCH)
+
+#define NPAGES    ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2PG(pa) (((uint64)(pa) - KERNBASE) >> PGSHIFT)
+#define PG2PA(i)  (KERNBASE + ((uint64)(i) << PGSHIFT))
+
 // run是一个链表结构
+// prev is only used on the buddy free lists.
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
+// Per-page state, indexed by PA2PG().
+struct page {
+  uint ref;      // references to an allocated page; updated atomically
+  uchar order;   // order of the block this page heads
+  uchar free;    // heads a block on buddy.free[order]
+  uchar tag;     // KM_ tag of an allocated page
+};
+struct page pages[NPAGES];
+
 struct {
+  struct spinlock lock;
+  // free[k] is a circular list of free 2^k-page blocks.
+  struct run free[MAXORDER+1];
+  uint64 nfree;  // pages on the free lists
+} buddy;
+
+// one per CPU, padded so that neighbouring locks do not
+// share a cache line.
+struct kmem {
   struct spinlock lock;
   // freelist是一个空闲页的链表
   struct run *freelist;
-} kmem;
+  int nfree;     // pages on freelist
+  long nalloc;   // pages allocated minus pages freed on this CPU;
+                 // written only by this CPU, with interrupts off.
+  long ntag[NKMTAG];  // nalloc, by tag
+  char name[8];
+} __attribute__((aligned(64)));
+
+struct kmem kmem[NCPU];
+
+// an idle hart wakes kzerod when the pool has fewer than
+// ZPOOL_LOW pages; kzerod then fills it up to ZPOOL_HIGH.
+#define ZPOOL_LOW   192
+#define ZPOOL_HIGH  256
+
+struct {
+  struct spinlock lock;
+  struct run *list;   // linked through the first word only
+  int n;
+  int sleeping;       // kzerod is waiting for the pool to drain
+} zpool;
+
+uint64 totalpages;  // pages managed by the allocator
 
 void
 kinit()
 {
-  // 对内存操作加锁，这把锁能够串行化内存分配
-  initlock(&kmem.lock, "kmem");
+  initlock(&buddy.lock, "buddy");
+  lockstat_register(&buddy.lock);
+  for(int k = 0; k <= MAXORDER; k++)
+    buddy.free[k].next = buddy.free[k].prev = &buddy.free[k];
+
+  // 对内存操作加锁，每个CPU一把锁
+  for(int i = 0; i < NCPU; i++){
+    safestrcpy(kmem[i].name, "kmem0", sizeof(kmem[i].name));
+    kmem[i].name[4] = '0' + i;
+    initlock(&kmem[i].lock, kmem[i].name);
+    lockstat_register(&kmem[i].lock);
+  }
+  initlock(&zpool.lock, "zpool");
+  shrinker_register("zpool", 0, zpool_shrink);
   // https://www.cnblogs.com/lilpig/p/17180784.html
-  // 将end到PHYSTOP的内存按页面加到freelist中
-  // kinit以end作为起始，PHYSTOP作为结束调用freerange，
-  // freerange的作用是把一个范围以页的形式挂载到freelist中
+  // 将end到PHYSTOP的内存按页面交给buddy分配器，
+  // 相邻的空闲页会被合并成尽可能大的块
   freerange(end, (void*)PHYSTOP);
+  totalpages = buddy.nfree;
   // end从哪来？PHYSTOP是什么？指针类型为何是void，地址end未必是4096的倍数
   // xv6的内核最大内存是写死的128MB，在risc-v主板上，0x80000000是物理内存的起始地址，
   // xv6会将内核的虚拟地址空间中的0x80000000到0x86400000共128MB映射到了物理地址空间的相同位置。
@@ -42,6 +143,8 @@ kinit()
   printf("end=%p PHYSTOP=%p\n",end, PHYSTOP);
 }
 
+static void buddy_free(void *pa, int order);
+
 void
 freerange(void *pa_start, void *pa_end)
 {
@@ -50,10 +153,93 @@ freerange(void *pa_start, void *pa_end)
   // PGROUNDUP这个宏就是在C层面进行4K对齐
   // pa_start是未对齐的数字，而p则是比它稍大的一个已经对齐的数字。
   // 对齐会造成一点点的空间浪费，但是能极大的提高读写效率。
-  // for循环，从可用的第一个页p开始，一直到pa_end，每次加一个页面大小，
-  // 然后调用kfree去释放页面，实际上就是加到freelist中。
+  acquire(&buddy.lock);
   for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+    buddy_free(p, 0);
+  release(&buddy.lock);
+}
+
+static void
+list_remove(struct run *r)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+}
+
+static void
+list_push(struct run *head, struct run *r)
+{
+  r->next = head->next;
+  r->prev = head;
+  head->next->prev = r;
+  head->next = r;
+}
+
+// Take a 2^order-page block off the buddy free lists,
+// splitting a larger block if needed. Returns 0 if no
+// block is big enough. Caller must hold buddy.lock.
+static void *
+buddy_alloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER; k++)
+    if(buddy.free[k].next != &buddy.free[k])
+      break;
+  if(k > MAXORDER)
+    return 0;
+
+  r = buddy.free[k].next;
+  list_remove(r);
+  pages[PA2PG(r)].free = 0;
+
+  // return the upper halves to the free lists.
+  while(k > order){
+    k--;
+    struct run *half = (struct run*)((char*)r + (PGSIZE << k));
+    pages[PA2PG(half)].order = k;
+    pages[PA2PG(half)].free = 1;
+    list_push(&buddy.free[k], half);
+  }
+  pages[PA2PG(r)].order = order;
+  buddy.nfree -= 1L << order;
+  return (void*)r;
+}
+
+// Return a 2^order-page block to the buddy free lists,
+// merging it with its buddy for as long as the buddy is
+// free as a whole. Caller must hold buddy.lock.
+static void
+buddy_free(void *pa, int order)
+{
+  uint64 i = PA2PG(pa);
+
+  buddy.nfree += 1L << order;
+  while(order < MAXORDER){
+    uint64 b = i ^ (1L << order);
+    if(!pages[b].free || pages[b].order != order)
+      break;
+    list_remove((struct run*)PG2PA(b));
+    pages[b].free = 0;
+    if(b < i)
+      i = b;
+    order++;
+  }
+  pages[i].order = order;
+  pages[i].free = 1;
+  list_push(&buddy.free[order], (struct run*)PG2PA(i));
+}
+
+// Account for n pages with the given tag allocated (n > 0)
+// or freed (n < 0) by the caller.
+static void
+kcount(int tag, long n)
+{
+  push_off();
+  kmem[cpuid()].nalloc += n;
+  kmem[cpuid()].ntag[tag] += n;
+  pop_off();
 }
 
 // Free the page of physical memory pointed at by pa,
@@ -63,64 +249,453 @@ freerange(void *pa_start, void *pa_end)
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *batch = 0;
+  int id;
+
   // 安全校验，地址是否按页面大小对齐，地址是否小于开始位置，大于等于最大内存位置
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  // only the last reference frees the page.
+  uint ref = __atomic_fetch_sub(&pages[PA2PG(pa)].ref, 1, __ATOMIC_ACQ_REL);
+  if(ref == 0)
+    panic("kfree: ref");
+  if(ref > 1)
+    return;
+
+#ifdef KALLOC_JUNK
   // Fill with junk to catch dangling refs.
   // 填充垃圾数据
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  // 加锁，向freelist链表头添加数据，更换freelist指向新的头，释放锁
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  // freelist变成了一个链表，每个链表项目是一个可以被分配使用的页面
-  release(&kmem.lock);
+  // cpuid() is only stable with interrupts off.
+  push_off();
+  id = cpuid();
+  // 加锁，向本CPU的freelist链表头添加数据
+  kmem[id].nalloc--;
+  kmem[id].ntag[pages[PA2PG(pa)].tag]--;
+  acquire(&kmem[id].lock);
+  r->next = kmem[id].freelist;
+  kmem[id].freelist = r;
+  if(++kmem[id].nfree > PCP_HIGH){
+    // hand a batch back so that the buddy allocator can coalesce it.
+    batch = kmem[id].freelist;
+    for(int n = 0; n < PCP_BATCH; n++)
+      kmem[id].freelist = kmem[id].freelist->next;
+    kmem[id].nfree -= PCP_BATCH;
+  }
+  release(&kmem[id].lock);
+
+  if(batch){
+    acquire(&buddy.lock);
+    for(int n = 0; n < PCP_BATCH; n++){
+      r = batch;
+      batch = batch->next;
+      buddy_free(r, 0);
+    }
+    release(&buddy.lock);
+  }
+  pop_off();
 }
 
-// Allocate one 4096-byte page of physical memory.
+// Move up to PCP_BATCH pages from another CPU's free list
+// to CPU id's list and return one of them, or 0 if every
+// list is empty. Never holds two kmem locks at once, so two
+// CPUs stealing from each other cannot deadlock.
+// Caller must have interrupts off.
+static struct run *
+ksteal(int id)
+{
+  struct run *r, *last;
+  int i, n;
+
+  for(i = 1; i < NCPU; i++){
+    struct kmem *victim = &kmem[(id + i) % NCPU];
+
+    acquire(&victim->lock);
+    r = victim->freelist;
+    last = r;
+    for(n = 1; last && last->next && n < PCP_BATCH; n++)
+      last = last->next;
+    if(r){
+      victim->freelist = last->next;
+      victim->nfree -= n;
+      last->next = 0;
+    }
+    release(&victim->lock);
+
+    if(r){
+      // keep the first page for the caller, cache the rest locally.
+      if(r->next){
+        acquire(&kmem[id].lock);
+        last->next = kmem[id].freelist;
+        kmem[id].freelist = r->next;
+        kmem[id].nfree += n - 1;
+        release(&kmem[id].lock);
+      }
+      return r;
+    }
+  }
+  return 0;
+}
+
+// Refill CPU id's empty list with up to PCP_BATCH pages from
+// the buddy allocator and return one of them, or 0.
+// Caller must have interrupts off.
+static struct run *
+krefill(int id)
+{
+  struct run *r, *head = 0;
+  int n;
+
+  acquire(&buddy.lock);
+  for(n = 0; n < PCP_BATCH; n++){
+    if((r = buddy_alloc(0)) == 0)
+      break;
+    r->next = head;
+    head = r;
+  }
+  release(&buddy.lock);
+
+  if(head == 0)
+    return 0;
+  if(head->next){
+    acquire(&kmem[id].lock);
+    r = head->next;
+    while(r->next)
+      r = r->next;
+    r->next = kmem[id].freelist;
+    kmem[id].freelist = head->next;
+    kmem[id].nfree += n - 1;
+    release(&kmem[id].lock);
+  }
+  return head;
+}
+
+// Take a page from this CPU's list, the buddy allocator, or
+// another CPU's list. Does not count it as allocated.
+static struct run *
+kget(void)
+{
+  struct run *r;
+  int id;
+
+  push_off();
+  id = cpuid();
+  acquire(&kmem[id].lock);
+  r = kmem[id].freelist;
+  if(r){
+    kmem[id].freelist = r->next;
+    kmem[id].nfree--;
+  }
+  release(&kmem[id].lock);
+
+  if(r == 0)
+    r = krefill(id);
+  if(r == 0)
+    r = ksteal(id);
+  pop_off();
+  return r;
+}
+
+// Take a page from the zeroed pool, or return 0.
+// Only the link word of the page is non-zero.
+static struct run *
+zpool_get(void)
+{
+  struct run *r;
+
+  acquire(&zpool.lock);
+  r = zpool.list;
+  if(r){
+    zpool.list = r->next;
+    zpool.n--;
+  }
+  release(&zpool.lock);
+  return r;
+}
+
+// Shrinker for the zeroed pool: give up to npages of its
+// pages back to the buddy allocator. Returns pages freed.
+static int
+zpool_shrink(int npages)
+{
+  struct run *r;
+  int n;
+
+  for(n = 0; n < npages && (r = zpool_get()) != 0; n++){
+    acquire(&buddy.lock);
+    buddy_free(r, 0);
+    release(&buddy.lock);
+  }
+  return n;
+}
+
+// Allocate one 4096-byte page of physical memory, for the
+// use that tag names.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
 // 分配物理内存中的4098Bytes大小的页面
 // 返回一个内核可用的指针
 // 若无法分配内存，返回0
 void *
-kalloc(void)
+kalloc(int tag)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  if((r = kget()) == 0 && (shrink(PCP_BATCH) == 0 || (r = kget()) == 0))
+    return 0;
+  pages[PA2PG(r)].ref = 1;
+  pages[PA2PG(r)].tag = tag;
+  kcount(tag, 1);
+#ifdef KALLOC_JUNK
+  memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  return (void*)r;
+}
+
+// Allocate one page of zeroed physical memory, from the
+// pre-zeroed pool when it has any.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(int tag)
+{
+  struct run *r;
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
+  if((r = zpool_get()) != 0){
+    r->next = 0;
+    pages[PA2PG(r)].ref = 1;
+    pages[PA2PG(r)].tag = tag;
+    kcount(tag, 1);
+    return (void*)r;
+  }
+  if((r = kalloc(tag)) != 0)
+    memset((char*)r, 0, PGSIZE);
   return (void*)r;
 }
 
-uint64 
-get_free_mem(void)
+// Add a reference to the page pa, which must have come
+// from kalloc().
+void
+kref(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kref");
+  __atomic_add_fetch(&pages[PA2PG(pa)].ref, 1, __ATOMIC_RELAXED);
+}
+
+// Number of references to the page pa.
+int
+krefcount(void *pa)
+{
+  return __atomic_load_n(&pages[PA2PG(pa)].ref, __ATOMIC_ACQUIRE);
+}
+
+// Called by an idle scheduler. Wakes kzerod if the pool is
+// running low; returns 1 if it did, so the scheduler should look for
+// work again instead of waiting for an interrupt.
+int
+kzero_idle(void)
+{
+  if(!__atomic_load_n(&zpool.sleeping, __ATOMIC_RELAXED) ||
+     __atomic_load_n(&zpool.n, __ATOMIC_RELAXED) >= ZPOOL_LOW)
+    return 0;
+  acquire(&zpool.lock);
+  zpool.sleeping = 0;
+  release(&zpool.lock);
+  wakeup(&zpool);
+  return 1;
+}
+
+// Kernel thread that keeps the zeroed pool topped up. It
+// runs only when woken by an idle hart, and goes back to
+// sleep once the pool is full or memory runs out.
+void
+kzerod(void)
 {
   struct run *r;
-  uint64 pages = 0; // 记录空闲页数
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  while (r)
-  {
-    pages++;
-    r = r->next;
+  for(;;){
+    acquire(&zpool.lock);
+    while(zpool.n >= ZPOOL_HIGH || zpool.sleeping){
+      zpool.sleeping = 1;
+      sleep(&zpool, &zpool.lock);
+    }
+    release(&zpool.lock);
+
+    if((r = kget()) == 0){
+      acquire(&zpool.lock);
+      zpool.sleeping = 1;
+      release(&zpool.lock);
+      continue;
+    }
+    memset((char*)r, 0, PGSIZE);
+
+    acquire(&zpool.lock);
+    r->next = zpool.list;
+    zpool.list = r;
+    zpool.n++;
+    release(&zpool.lock);
   }
-  release(&kmem.lock);
+}
 
-  return (pages << 12); // Book P29
-  // better one: return (pages << PGSHIFT);
+// Give every page cached on the per-CPU lists back to the
+// buddy allocator so that it can form large blocks again.
+static void
+kdrain(void)
+{
+  struct run *r, *next;
+
+  for(int i = 0; i < NCPU; i++){
+    acquire(&kmem[i].lock);
+    r = kmem[i].freelist;
+    kmem[i].freelist = 0;
+    kmem[i].nfree = 0;
+    release(&kmem[i].lock);
+
+    acquire(&buddy.lock);
+    for(; r; r = next){
+      next = r->next;
+      buddy_free(r, 0);
+    }
+    release(&buddy.lock);
+  }
 }
 
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. order 0 is the same as kalloc().
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_order(int order, int tag)
+{
+  void *pa;
 
+  if(order < 0 || order > MAXORDER)
+    panic("kalloc_order");
+  if(order == 0)
+    return kalloc(tag);
+
+  acquire(&buddy.lock);
+  pa = buddy_alloc(order);
+  release(&buddy.lock);
+  if(pa == 0){
+    // the missing buddies may be sitting in per-CPU caches,
+    // or in the kernel's caches.
+    shrink(1 << order);
+    kdrain();
+    acquire(&buddy.lock);
+    pa = buddy_alloc(order);
+    release(&buddy.lock);
+  }
+
+  if(pa){
+    pages[PA2PG(pa)].ref = 1;
+    pages[PA2PG(pa)].tag = tag;
+    kcount(tag, 1L << order);
+#ifdef KALLOC_JUNK
+    memset(pa, 5, PGSIZE << order); // fill with junk
+#endif
+  }
+  return pa;
+}
+
+// Drop a reference to a block returned by kalloc_order(order),
+// and free the block if it was the last, like kfree(); kref()
+// of the block's address adds a reference. Returns 1 if the
+// block was freed.
+int
+kfree_order(void *pa, int order)
+{
+  if(order < 0 || order > MAXORDER || ((uint64)pa % (PGSIZE << order)) != 0 ||
+     (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kfree_order");
+
+  uint ref = __atomic_fetch_sub(&pages[PA2PG(pa)].ref, 1, __ATOMIC_ACQ_REL);
+  if(ref == 0)
+    panic("kfree_order: ref");
+  if(ref > 1)
+    return 0;
+  if(order == 0){
+    // kfree() drops the reference itself.
+    pages[PA2PG(pa)].ref = 1;
+    kfree(pa);
+    return 1;
+  }
+
+#ifdef KALLOC_JUNK
+  memset(pa, 1, PGSIZE << order);
+#endif
+  kcount(pages[PA2PG(pa)].tag, -(1L << order));
+  acquire(&buddy.lock);
+  buddy_free(pa, order);
+  release(&buddy.lock);
+  return 1;
+}
+
+// Turn a block returned by kalloc_order(order), with a single
+// reference, into 2^order pages with one reference each, that
+// kfree() then frees one at a time.
+void
+ksplit(void *pa, int order)
+{
+  struct page *pg = &pages[PA2PG(pa)];
+
+  if(order < 0 || order > MAXORDER || ((uint64)pa % (PGSIZE << order)) != 0 ||
+     krefcount(pa) != 1)
+    panic("ksplit");
+  for(int i = 1; i < (1 << order); i++){
+    pg[i].ref = 1;
+    pg[i].tag = pg->tag;
+  }
+}
+
+// Number of pages currently allocated. Lock-free, so the
+// result may be slightly stale while other CPUs allocate.
+uint64
+get_used_pages(void)
+{
+  long n = 0;
+
+  for(int i = 0; i < NCPU; i++)
+    n += __atomic_load_n(&kmem[i].nalloc, __ATOMIC_RELAXED);
+  return n < 0 ? 0 : n;
+}
+
+// Store the number of pages allocated with each tag in
+// n[0..NKMTAG-1]. Lock-free, like get_used_pages().
+void
+get_tag_pages(uint64 *n)
+{
+  long t;
+
+  for(int tag = 0; tag < NKMTAG; tag++){
+    t = 0;
+    for(int i = 0; i < NCPU; i++)
+      t += __atomic_load_n(&kmem[i].ntag[tag], __ATOMIC_RELAXED);
+    n[tag] = t < 0 ? 0 : t;
+  }
+}
+
+// Pages in the zeroed pool; they count as free.
+uint64
+get_zpool_pages(void)
+{
+  return __atomic_load_n(&zpool.n, __ATOMIC_RELAXED);
+}
+
+// Pages managed by the allocator.
+uint64
+get_total_pages(void)
+{
+  return totalpages;
+}
+
+// Bytes of free memory, in constant time and without locks.
+uint64 
+get_free_mem(void)
+{
+  return (totalpages - get_used_pages()) << PGSHIFT; // Book P29
+}
@@ -0,0 +1,6 @@
+// Contention counters for one spinlock, as returned by lockstat().
+struct lockstat {
+  char name[16];   // lock name
+  uint64 n;        // number of acquires
+  uint64 nts;      // failed test-and-sets while waiting
+};
@@ -32,15 +32,18 @@ main()
     // 在xv6中，完成这个功能的结构是kernel/kalloc.c文件中kmem结构体中的freelist链表
     // https://www.cnblogs.com/lilpig/p/17180784.html
     kinit();         // physical page allocator，物理页分配器
+    slabinit();      // slab caches，slab缓存
     // kinit 一切操作都是直接在物理内存做的，并没有做虚拟地址转换。
     // 在kvminit函数中挂载了内核页表，并做了一些基本的映射。
     // 调用kalloc分配一个页，作为内核页表，并将硬件设备、kernel text、kernel data做一个虚拟地址与实际物理地址相等的直接映射。
     kvminit();       // create kernel page table，创建内核页表
     // 切换硬件的页表寄存器到内核页表，并开启虚拟地址转换
     kvminithart();   // turn on paging，启用分页
+    asidinit();      // address-space identifiers
     //至此，xv6启动时的内核页表挂载过程执行完成。
 
     procinit();      // process table，进程表
+    runqinit();      // per-CPU run queues
 
     // https://www.cnblogs.com/lilpig/p/17244493.html
     // 中断是一种trap），当一个设备发起了一个中断，内核的trap处理代码识别它并调用设备的中断处理器。
@@ -56,8 +59,11 @@ main()
     binit();         // buffer cache，缓冲区缓存
     iinit();         // inode table，inode缓存
     fileinit();      // file table，文件表
+    pipeinit();      // pipe cache，管道缓存
     virtio_disk_init(); // emulated hard disk，模拟硬盘
     userinit();      // first user process，第一个用户进程
+    kthread_create("kzerod", kzerod); // zeroes free pages when idle，空闲时预先清零页面
+    kthread_create("kreclaimd", kreclaimd); // reclaims memory when low，内存不足时回收
     __sync_synchronize();
     started = 1;
   } else {
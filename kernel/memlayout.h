@@ -29,6 +29,7 @@
 #define CLINT 0x2000000L
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid)) // software interrupt
 
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
@@ -47,6 +48,14 @@
 #define KERNBASE 0x80000000L
 #define PHYSTOP (KERNBASE + 128*1024*1024)
 
+// the kernel maps the CLINT's first page, which holds the
+// msip registers it sends IPIs with, just above that RAM,
+// and the page of mtimecmp registers after it, so that each
+// hart can program its own timer (timer.c).
+#define CLINTVA PHYSTOP
+#define CLINTVA_MSIP(hartid) (CLINTVA + 4*(hartid))
+#define CLINTVA_MTIMECMP(hartid) (CLINTVA + PGSIZE + 8*(hartid))
+
 // map the trampoline page to the highest address,
 // in both user and kernel space.
 #define TRAMPOLINE (MAXVA - PGSIZE)
@@ -62,8 +71,13 @@
 //   text
 //   original data and bss
 //   fixed-size stack
-//   expandable heap
+//   expandable heap, up to MAXUVA
 //   ...
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// user memory stays below the PLIC, so that it can be
+// mirrored in the kernel page table without overlapping
+// device mappings.
+#define MAXUVA PLIC
@@ -1,8 +1,8 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NVMA         16  // memory areas per process
+#define NINODE       50  // maximum number of cached unused i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
@@ -10,4 +10,9 @@
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       2000  // size of file system in blocks
+#define NSWAP       65536  // size of swap area after the file system, in blocks
 #define MAXPATH      128   // maximum file path name
+#define MAXORDER       9   // largest kalloc_order() block is 2^MAXORDER pages
+#define NPRIO          3   // MLFQ scheduling levels
+#define NTICKETS     100   // stride scheduling tickets of a new process
+#define TICKCYCLES 1000000 // timer cycles per tick; about 1/10th second in qemu
@@ -17,8 +17,23 @@ struct pipe {
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int reading;    // a reader is copying out; see piperead()
 };
 
+static struct kmem_cache *pipecache;
+
+static void
+pipector(void *o)
+{
+  initlock(&((struct pipe*)o)->lock, "pipe");
+}
+
+void
+pipeinit(void)
+{
+  pipecache = kmem_cache_create("pipe", sizeof(struct pipe), pipector);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,13 +43,13 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = kmem_cache_alloc(pipecache)) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
-  initlock(&pi->lock, "pipe");
+  pi->reading = 0;
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -47,7 +62,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    kmem_cache_free(pipecache, pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,43 +83,66 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    kmem_cache_free(pipecache, pi);
   } else
     release(&pi->lock);
 }
 
+// pipewrite() and piperead() copy between user space and a
+// buffer on the kernel stack without holding pi->lock, since
+// copyin() and copyout() may fault pages in, which can sleep.
+// piperead() takes bytes out of the pipe only once they have
+// been copied out, so a failed copyout() loses nothing; one
+// reader at a time, pi->reading, copies.
+//
+// They wake one waiter of the other kind at a time, with
+// wakeup_one(). A waiter that leaves while the pipe still has
+// room (a writer) or data (a reader) wakes the next one of
+// its own kind, so that a wakeup is never lost; pipeclose()
+// wakes them all.
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, j, m;
   struct proc *pr = myproc();
+  char buf[PIPESIZE];
 
-  // 获取管道锁，避免管道中数据错乱
-  acquire(&pi->lock);
-  // 遍历每一个要写入buffer的字节
   while(i < n){
-    // 如果进程已经关闭或者管道读端已经关闭，释放管道锁，写入失败
-    if(pi->readopen == 0 || killed(pr)){
+    m = n - i < sizeof(buf) ? n - i : sizeof(buf);
+    if(copyin(pr->pagetable, buf, addr + i, m) == -1){
+      acquire(&pi->lock);
+      wakeup_one(&pi->nwrite);
       release(&pi->lock);
-      return -1;
+      break;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      // 唤醒在nread上睡眠的进程，让它们从管道中取数据
-      wakeup(&pi->nread);
-      // 在nwrite上睡眠
-      sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      // 实际复制数据到data缓冲区
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+    // 获取管道锁，避免管道中数据错乱
+    acquire(&pi->lock);
+    // 遍历每一个要写入buffer的字节
+    for(j = 0; j < m; ){
+      // 如果进程已经关闭或者管道读端已经关闭，释放管道锁，写入失败
+      if(pi->readopen == 0 || killed(pr)){
+        wakeup_one(&pi->nwrite);
+        release(&pi->lock);
+        return -1;
+      }
+      if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+        // 唤醒在nread上睡眠的进程，让它们从管道中取数据
+        wakeup_one(&pi->nread);
+        // 在nwrite上睡眠
+        sleep(&pi->nwrite, &pi->lock);
+      } else {
+        // 实际复制数据到data缓冲区
+        pi->data[pi->nwrite++ % PIPESIZE] = buf[j++];
+      }
     }
+    // 写入完成，唤醒在nread上睡眠的进程，释放管道锁
+    wakeup_one(&pi->nread);
+    // done, with room left over: the next writer's turn.
+    if(i + m == n && pi->nwrite != pi->nread + PIPESIZE)
+      wakeup_one(&pi->nwrite);
+    release(&pi->lock);
+    i += m;
   }
-  // 写入完成，唤醒在nread上睡眠的进程，释放管道锁
-  wakeup(&pi->nread);
-  release(&pi->lock);
 
   return i;
 }
@@ -112,33 +150,51 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, r;
   struct proc *pr = myproc();
-  char ch;
+  char buf[PIPESIZE];
 
   // 获取管道锁以避免读写混乱
   acquire(&pi->lock);
   // 在管道为空（并且写入端是开启的）这个条件上循环
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  // also wait while another reader is copying out.
+  while((pi->nread == pi->nwrite && pi->writeopen) || pi->reading){  //DOC: pipe-empty
     // 如果进程已经被杀死，释放管道锁，读取宣告失败
     if(killed(pr)){
+      wakeup_one(&pi->nread);
       release(&pi->lock);
       return -1;
     }
      // 如果管道为空且写入端开启（可能有人会写入数据），在nread上睡眠
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  // 实际读取
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  // 实际读取, leaving the bytes in the pipe until copied out.
+  for(i = 0; i < n && i < sizeof(buf); i++){  //DOC: piperead-copy
+    if(pi->nread + i == pi->nwrite)
       break;
+    buf[i] = pi->data[(pi->nread + i) % PIPESIZE];
+  }
+  if(i == 0){
+    // end of file.
+    release(&pi->lock);
+    return 0;
   }
-  // 因为已经读了数据，所以管道中可能已经有一些空间了，唤醒在nwrite上睡眠的写进程
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  pi->reading = 1;
+  release(&pi->lock);
+  r = copyout(pr->pagetable, addr, buf, i);
+  acquire(&pi->lock);
+  pi->reading = 0;
+  if(r == 0){
+    pi->nread += i;
+    // 因为已经读了数据，所以管道中可能已经有一些空间了，唤醒在nwrite上睡眠的写进程
+    wakeup_one(&pi->nwrite);  //DOC: piperead-wakeup
+  }
+  // data left over, or end of file: the next reader's turn.
+  // one that waited for pi->reading while the write end was
+  // closed has only this wakeup to see end of file by.
+  if(pi->nread != pi->nwrite || !pi->writeopen)
+    wakeup_one(&pi->nread);
   // 释放管道锁
   release(&pi->lock);
-  return i;
+  return r < 0 ? -1 : i;
 }
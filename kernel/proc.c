@@ -5,8 +5,13 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "fcntl.h"
+#include "sysinfo.h"
+#include "cpustat.h"
+#include "timeout.h"
 
 struct cpu cpus[NCPU];
+struct cpustat cpustat[NCPU];  // each hart updates only its own
 
 struct proc proc[NPROC];
 
@@ -15,11 +20,35 @@ struct proc *initproc;
 int nextpid = 1;
 struct spinlock pid_lock;
 
+int nproc;  // procs not UNUSED; updated atomically, read by sysinfo
+
+// free pages fork() makes sure of before allocating the child:
+// enough for the page tables of an address space that spans
+// MAXUVA, and for its kernel pages.
+#define FORKRESERVE (MAXUVA / LEVELSIZE(1) + 16)
+
 extern void forkret(void);
+static void kthread_start(void);
 static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
+// Sleeping processes, hashed by the channel they sleep on, so
+// that wakeup() only looks at the processes of one bucket
+// instead of all of proc[]. A process is on its bucket's list,
+// oldest first, exactly while it is SLEEPING; the bucket's
+// lock protects the list, and p->chan of the processes on it.
+// Lock order: the lock passed to sleep(), a bucket's lock,
+// then p->lock.
+#define SLEEPQ_SHIFT 6
+#define NSLEEPQ (1 << SLEEPQ_SHIFT)
+
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;           // linked through p->sqnext
+  struct proc *tail;
+} sleepq[NSLEEPQ];
+
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
 // memory model when using p->parent.
@@ -39,7 +68,7 @@ proc_mapstacks(pagetable_t kpgtbl)
   // 循环获取每个进程，xv6中最大允许64个进程
   for(p = proc; p < &proc[NPROC]; p++) {
     // 分配页面
-    char *pa = kalloc();
+    char *pa = kalloc(KM_KSTACK);
     if(pa == 0)
       panic("kalloc");
     // 内核栈的虚拟地址位置
@@ -57,6 +86,8 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       // p->state = UNUSED;
@@ -133,9 +164,14 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->cpu = cpuid();   // first runs on this hart's run queue
+  p->prio = p->slice = p->basepri = 0;
+  p->pass = 0;
+  settickets(p, NTICKETS);
+  __sync_fetch_and_add(&nproc, 1);
 
   // Allocate a trapframe page.
-  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
+  if((p->trapframe = (struct trapframe *)kalloc(KM_TRAPFRAME)) == 0){
     freeproc(p);
     release(&p->lock);
     return 0;
@@ -143,10 +179,15 @@ found:
 
   // Init kernel page table per process.
   // my code
-  p->kpagetable = vmmake();
+  // 与kernel_pagetable共享不变的子树，只有内核栈所在的页表页是私有的
+  if((p->kpagetable = kvmcreate()) == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
 
   // 在该进程内核页表中为该进程分配内核栈
-  char *pa = kalloc();
+  char *pa = kalloc(KM_KSTACK);
   if(pa == 0)
    panic("allocproc: alloc kstack");
   uint64 va = TRAMPOLINE - 2*PGSIZE; // 内核栈地址
@@ -196,6 +237,7 @@ freeproc(struct proc *p)
   if(p->kpagetable) // 回收页表
     proc_freekpagetable(p->kpagetable, p->kstack);
   p->kpagetable = 0;
+  asid_invalidate(p); // 页表已释放，ASID不能再给下一个进程用
 
   p->pagetable = 0;
   p->sz = 0;
@@ -208,6 +250,8 @@ freeproc(struct proc *p)
 
   p->state = UNUSED;
   p->tracemask = 0;
+  p->kfn = 0;
+  __sync_fetch_and_sub(&nproc, 1);
 
 }
 
@@ -295,8 +339,24 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
+
+  release(&p->lock);
+}
+
+// Create a kernel thread that runs fn() in the kernel, with no
+// user memory. fn must never return.
+void
+kthread_create(char *name, void (*fn)(void))
+{
+  struct proc *p;
 
+  if((p = allocproc()) == 0)
+    panic("kthread_create");
+  p->kfn = fn;
+  p->context.ra = (uint64)kthread_start;
+  safestrcpy(p->name, name, sizeof(p->name));
+  setrunnable(p);
   release(&p->lock);
 }
 
@@ -310,11 +370,15 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    // allocated lazily, on first touch; see uvmfault().
+    if(sz + n > MAXUVA || sz + n < sz ||
+       vma_overlap(p->vma, PGROUNDUP(sz), sz + n))
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    // fails if a megapage must be split and there is no memory.
+    if((sz = uvmdealloc(p->pagetable, sz, sz + n)) != p->sz + n)
+      return -1;
   }
   p->sz = sz;
   return 0;
@@ -332,6 +396,10 @@ fork(void)
 
   // pte_t *pte, *kpte;
 
+  // the child's page tables and kernel pages are allocated
+  // under np->lock, where nothing can be swapped out.
+  swapreserve(FORKRESERVE);
+
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
@@ -351,6 +419,24 @@ fork(void)
   // }
 
   np->sz = p->sz;
+  vma_dup(np->vma, p->vma);
+
+  // Copy the pages of memory areas above the heap, i.e. mmap()s.
+  for(i = 0; i < NVMA; i++){
+    struct vma *v = &p->vma[i];
+    uint64 start = v->start > PGROUNDUP(p->sz) ? v->start : PGROUNDUP(p->sz);
+    if(v->end > start &&
+       uvmcopyrange(p->pagetable, np->pagetable, start, v->end,
+                    v->flags & MAP_SHARED) < 0){
+      // dropping the areas' files can sleep.
+      release(&np->lock);
+      vma_unmap(np, 0, MAXUVA);
+      acquire(&np->lock);
+      freeproc(np);
+      release(&np->lock);
+      return -1;
+    }
+  }
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -371,6 +457,12 @@ fork(void)
   // 从父亲那里拷贝跟踪mask给子，实验（systemcall）
   np->tracemask = p->tracemask;
 
+  // batch work stays low in its children too, and shares
+  // are inherited.
+  np->prio = np->basepri = p->basepri;
+  settickets(np, p->tickets);
+  np->pass = p->pass;
+
   release(&np->lock);
 
   acquire(&wait_lock);
@@ -378,7 +470,7 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
@@ -419,6 +511,10 @@ exit(int status)
     }
   }
 
+  // Write back shared mappings and drop the files
+  // backing memory areas.
+  vma_unmap(p, 0, MAXUVA);
+
   begin_op();
   iput(p->cwd);
   end_op();
@@ -450,7 +546,7 @@ int
 wait(uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
@@ -467,12 +563,18 @@ wait(uint64 addr)
         if(pp->state == ZOMBIE){
           // Found one.
           pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
+          xstate = pp->xstate;
+          release(&pp->lock);
+          release(&wait_lock);
+          // copyout() may fault the page in, which can sleep,
+          // so not while holding the locks. only p reaps pp,
+          // so it stays a zombie meanwhile, and stays one if
+          // the copy fails, to be waited for again.
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                  sizeof(xstate)) < 0)
             return -1;
-          }
+          acquire(&wait_lock);
+          acquire(&pp->lock);
           freeproc(pp);
           release(&pp->lock);
           release(&wait_lock);
@@ -500,6 +602,7 @@ wait(uint64 addr)
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
+// The process comes off this hart's run queue, see runq.c.
 // 每个CPU上的进程调度器
 // 在设置完自己后，每一个CPU都调用scheduler()
 // scheduler永不反悔，它循环做下面的事：
@@ -518,38 +621,47 @@ scheduler(void)
     intr_on();
 
     int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
+    if((p = runq_take()) != 0) {
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      p->state = RUNNING;
+      c->proc = p;
 
-        // my code
-        w_satp(MAKE_SATP(p->kpagetable));
-        sfence_vma();
+      // my code
+      // tagged with p's ASID, so no TLB flush is needed.
+      asid_activate(p);
+      w_satp(MAKE_SATP_ASID(p->kpagetable, p->asid));
 
-        swtch(&c->context, &p->context);
+      swtch(&c->context, &p->context);
 
-        // my code:
-        kvminithart(); // 切换回内核页表
+      // my code:
+      kvmswitch(); // 切换回内核页表
 
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
 
-        // my code
-        found = 1;
-      }
+      // my code
+      found = 1;
       release(&p->lock);
     }
+    // start reclaiming before allocations fail.
+    kreclaim_wake();
     // mycode
+    // nothing to run: zero pages for kalloc_zeroed() instead.
+    if(found == 0 && kzero_idle())
+      continue;
 #if !defined (LAB_FS)
     if(found == 0) {
-      intr_on();
-      asm volatile("wfi");
+      // idle with the tick off; see timer.c. with interrupts
+      // off, one that comes after the check still ends the wfi.
+      intr_off();
+      timer_idle();
+      int work = timer_work();
+      if(!work)
+        asm volatile("wfi");
+      timer_busy(!work);
     }
 #else
     ;
@@ -593,7 +705,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -619,27 +731,75 @@ forkret(void)
   usertrapret();
 }
 
-// Atomically release lock and sleep on chan.
-// Reacquires lock when awakened.
-void
-sleep(void *chan, struct spinlock *lk)
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthread_start.
+static void
+kthread_start(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+  p->kfn();
+  panic("kthread_start: returned");
+}
+
+// The bucket of processes sleeping on chan.
+static struct sleepq*
+sleepq_of(void *chan)
+{
+  // Fibonacci hashing: the high bits of the product depend on
+  // all bits of the address.
+  return &sleepq[((uint64)chan * 0x9E3779B97F4A7C15L) >> (64 - SLEEPQ_SHIFT)];
+}
+
+// Remove p, which follows prev, from q's list, and make it
+// RUNNABLE. Caller must hold q->lock and p->lock.
+static void
+sleepq_remove(struct sleepq *q, struct proc *prev, struct proc *p)
+{
+  if(prev)
+    prev->sqnext = p->sqnext;
+  else
+    q->head = p->sqnext;
+  if(q->tail == p)
+    q->tail = prev;
+  setrunnable(p);
+}
+
+// Atomically release lock, and lk2 if not 0, and sleep on
+// chan. Reacquires lock when awakened.
+static void
+sleep1(void *chan, struct spinlock *lk, struct spinlock *lk2)
 {
   struct proc *p = myproc();
+  struct sleepq *q = sleepq_of(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold the bucket's lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks it),
   // so it's okay to release lk.
 
+  acquire(&q->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
+  if(lk2)
+    release(lk2);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
-
+  p->sqnext = 0;
+  if(q->tail)
+    q->tail->sqnext = p;
+  else
+    q->head = p;
+  q->tail = p;
+  release(&q->lock);
+
+  // wakeup() takes p off the list.
   sched();
 
   // Tidy up.
@@ -650,22 +810,106 @@ sleep(void *chan, struct spinlock *lk)
   acquire(lk);
 }
 
+// Atomically release lock and sleep on chan.
+// Reacquires lock when awakened.
+void
+sleep(void *chan, struct spinlock *lk)
+{
+  sleep1(chan, lk, 0);
+}
+
+// Timeout function of sleep_timeout().
+static void
+sleep_expired(struct timeout *to)
+{
+  wakeup(to->arg);
+}
+
+// Like sleep(), but also wake up when ticks reaches when,
+// if nothing has woken p by then. chan may be 0, to wait
+// for the time only. Returns 1 if the time came.
+// Lock order: lk, then tickslock, then the sleep queues.
+int
+sleep_timeout(void *chan, struct spinlock *lk, uint when)
+{
+  struct timeout to;
+  int expired;
+
+  timeout_init(&to, sleep_expired, chan ? chan : &to);
+  if(lk != &tickslock)
+    acquire(&tickslock);
+  timeout_add(&to, when);
+  // keep tickslock until p is on the sleep queue, so that
+  // the timeout cannot go off before.
+  sleep1(to.arg, lk, lk != &tickslock ? &tickslock : 0);
+  if(lk != &tickslock)
+    acquire(&tickslock);
+  expired = !timeout_del(&to);
+  if(lk != &tickslock)
+    release(&tickslock);
+  return expired;
+}
+
+// Wake up to n processes sleeping on chan, oldest first, or
+// all of them if n < 0. Returns the number woken.
+static int
+wake(void *chan, int n)
+{
+  struct sleepq *q = sleepq_of(chan);
+  struct proc *p, *prev = 0, *next;
+  int woken = 0;
+
+  acquire(&q->lock);
+  for(p = q->head; p && woken != n; p = next){
+    next = p->sqnext;
+    if(p->chan == chan){
+      acquire(&p->lock);
+      sleepq_remove(q, prev, p);
+      release(&p->lock);
+      woken++;
+    } else {
+      prev = p;
+    }
+  }
+  release(&q->lock);
+  return woken;
+}
+
 // Wake up all processes sleeping on chan.
 // Must be called without any p->lock.
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  wake(chan, -1);
+}
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
+// Wake up the process that has slept on chan the longest,
+// for when only one of them can make progress; if it cannot
+// after all, it must pass the wakeup on. Returns 1 if there
+// was one. Must be called without any p->lock.
+int
+wakeup_one(void *chan)
+{
+  return wake(chan, 1);
+}
+
+// Wake p if it is still sleeping on chan, for kill().
+static void
+unsleep(struct proc *p, void *chan)
+{
+  struct sleepq *q = sleepq_of(chan);
+  struct proc *pp, *prev = 0;
+
+  acquire(&q->lock);
+  for(pp = q->head; pp; prev = pp, pp = pp->sqnext){
+    if(pp == p){
       acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
+      sleepq_remove(q, prev, p);
       release(&p->lock);
+      break;
     }
   }
+  release(&q->lock);
 }
 
 // Kill the process with the given pid.
@@ -675,15 +919,44 @@ int
 kill(int pid)
 {
   struct proc *p;
+  void *chan;
+  int sleeping;
 
   for(p = proc; p < &proc[NPROC]; p++){
     acquire(&p->lock);
     if(p->pid == pid){
       p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
+      sleeping = p->state == SLEEPING;
+      chan = p->chan;
+      release(&p->lock);
+      if(sleeping){
+        // Wake process from sleep(). Its bucket's lock comes
+        // before p->lock; if p woke up meanwhile and sleeps
+        // again, p->killed is already set for it to check.
+        unsleep(p, chan);
       }
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Set the highest MLFQ level that the process with the given
+// pid may run at; see runq.c. Its children inherit it.
+// Returns 0, or -1 if there is no such process or prio is
+// not a level.
+int
+setpriority(int pid, int prio)
+{
+  struct proc *p;
+
+  if(prio < 0 || prio >= NPRIO)
+    return -1;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid){
+      p->basepri = prio;
       release(&p->lock);
       return 0;
     }
@@ -692,6 +965,27 @@ kill(int pid)
   return -1;
 }
 
+// The MLFQ level that the process with the given pid last ran
+// or was queued at, or -1 if there is no such process. Always
+// 0 under round robin.
+int
+getpriority(int pid)
+{
+  struct proc *p;
+  int prio;
+
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid){
+      prio = p->prio;
+      release(&p->lock);
+      return prio;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
 void
 setkilled(struct proc *p)
 {
@@ -772,35 +1066,31 @@ procdump(void)
 }
 
 // my code
+// number of processes that are not UNUSED, without locking.
 uint64
 get_proc_num(void)
 {
-  struct proc *p;
-  uint64 cnt = 0;
+  return __atomic_load_n(&nproc, __ATOMIC_RELAXED);
+}
 
-  for (p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if (p->state != UNUSED)
-      cnt++;
-    release(&p->lock);
-  }
+// Copy the counters of up to max harts to the user address
+// addr. Returns the number copied, or -1.
+int
+cpustat_copyout(uint64 addr, int max)
+{
+  int i;
 
-  return cnt;
+  for(i = 0; i < NCPU && i < max; i++)
+    if(copyout(myproc()->pagetable, addr + i*sizeof(struct cpustat),
+               (char*)&cpustat[i], sizeof(struct cpustat)) < 0)
+      return -1;
+  return i;
 }
 
  // my code:
- extern char etext[];
-
  void 
  proc_freekpagetable(pagetable_t pt, uint64 kstack)
 {
-    // 怎么分配的怎么销毁
-    kvmunmap(pt, UART0, PGSIZE);
-    kvmunmap(pt, VIRTIO0, PGSIZE);
-    kvmunmap(pt, CLINT, 0x10000);
-    kvmunmap(pt, PLIC, 0x400000);
-    kvmunmap(pt, KERNBASE, (uint64)etext-KERNBASE);
-    kvmunmap(pt, (uint64)etext, PHYSTOP-(uint64)etext);
-    kvmunmap(pt, TRAMPOLINE, PGSIZE);
-    freewalk(pt);
-}
\ No newline at end of file
+    // 只回收私有的页表页，共享的子树属于kernel_pagetable
+    kvmfree(pt);
+}
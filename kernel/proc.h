@@ -18,12 +18,25 @@ struct context {
   uint64 s11;
 };
 
+// A request to flush user pages from a hart's TLB, sent by
+// tlb_flush() on another hart.
+struct tlbreq {
+  int busy;                   // claimed by an initiator
+  int ready;                  // set by the initiator, cleared once done
+  uint asid;                  // flush the pages of ASIDs asid and asid+1
+  uint64 start, end;          // pages in [start, end)
+};
+
 // Per-CPU state.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation this hart's TLB was flushed for
+  struct tlbreq tlbreq;       // TLB shootdown mailbox; see tlb.c
+  int idle;                   // in wfi with its tick off; see timer.c
+  uint64 idlestart;           // time it went idle
 };
 
 extern struct cpu cpus[NCPU];
@@ -79,6 +92,29 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A range of user memory whose pages are filled on first
+// access: the first filesz bytes from inode ip at offset off,
+// the rest with zeros. See vma.c.
+struct vma {
+  uint64 start;                // page-aligned; end == 0 if unused
+  uint64 end;
+  int perm;                    // PTE_R, PTE_W, PTE_X, PTE_U for its pages
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+  struct inode *ip;            // backing file, or 0
+  uint64 off;                  // file offset of start
+  uint64 filesz;               // bytes backed by the file
+};
+
+// User pages whose mappings changed, gathered for one TLB
+// flush by tlb_flush(). See tlb.c.
+struct tlbbatch {
+  struct proc *p;              // whose mappings; 0 if none in use
+  uint asid;                   // p's ASIDs, harts and generation
+  uint64 cpumask;              //   when the batch began
+  uint64 gen;
+  uint64 start, end;           // changed pages are in [start, end)
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -98,6 +134,7 @@ struct proc {
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
+  struct vma vma[NVMA];        // Demand-filled memory areas: segments, mmap()s
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
@@ -106,4 +143,19 @@ struct proc {
   char name[16];               // Process name (debugging)
   int tracemask;               // 实验（syscall）加的，用来跟踪系统调用
   pagetable_t kpagetable;      // kpagetable,新添加的内容
+  void (*kfn)(void);           // kernel thread body, if a kernel thread
+  uint asid;                   // ASID of kpagetable; asid+1 is pagetable's
+  uint64 asidgen;              // generation of asid; 0 if it has none
+  uint64 cpumask;              // harts whose TLBs may hold entries of asid
+  int cpu;                     // hart whose run queue p goes on; p->lock
+  struct proc *rqnext;         // next on its run queue; see runq.c
+  struct proc *sqnext;         // next sleeping in its bucket; see sleep()
+  int prio;                    // MLFQ level, 0 first
+  int slice;                   // ticks run at prio
+  int basepri;                 // highest level p may run at; p->lock
+  uint boostgen;               // MLFQ boosts p has seen
+  int tickets;                 // stride scheduling share; see settickets()
+  uint64 stride;               //   STRIDE1 / tickets
+  uint64 pass;                 //   virtual time; the lowest pass runs next
+  uint64 wakets;               // time wakeup() made p RUNNABLE, or 0
 };
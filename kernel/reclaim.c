@@ -0,0 +1,128 @@
+// Reclaiming memory from kernel caches.
+//
+// Subsystems that keep memory they could give back, like the
+// zeroed-page pool, the inode cache and the slab caches,
+// register a shrinker: a function that frees up to a given
+// number of pages and returns how many it freed. Shrinkers
+// are kept sorted by cost, and shrink() runs them cheapest
+// first until enough pages are free.
+//
+// kalloc() calls shrink() before it gives up, so shrinkers
+// run in whatever context kalloc() was called from, possibly
+// holding spinlocks: a shrinker must not sleep, and must use
+// tryacquire() for any lock that a kalloc() caller may hold,
+// skipping its work if the lock is busy.
+//
+// So that allocations rarely get that far, the scheduler wakes
+// the kreclaimd kernel thread when free memory drops below
+// RECLAIM_LOW pages. kreclaimd runs the shrinkers, and then
+// swaps out user pages, until RECLAIM_HIGH pages are free. A
+// pass that frees nothing, with swap full or every page in
+// use, is not retried for RECLAIM_BACKOFF ticks, so that the
+// scheduler does not wake kreclaimd to scan in vain on every
+// pass, and the hart can go idle.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NSHRINKER     8
+#define RECLAIM_LOW   256   // pages
+#define RECLAIM_HIGH  512
+#define RECLAIM_BACKOFF 10  // ticks
+
+struct shrinker {
+  char *name;
+  int cost;
+  int (*scan)(int);
+};
+
+struct {
+  struct spinlock lock;
+  struct shrinker shrinkers[NSHRINKER];  // cheapest first
+  int n;
+  int sleeping;       // kreclaimd is waiting for memory to run low
+} reclaim;
+
+static int
+freepages(void)
+{
+  return get_free_mem() / PGSIZE;
+}
+
+// Register scan as a shrinker of the given cost. Called at
+// boot, before other harts start.
+void
+shrinker_register(char *name, int cost, int (*scan)(int))
+{
+  int i;
+
+  if(reclaim.n == NSHRINKER)
+    panic("shrinker_register");
+  for(i = reclaim.n; i > 0 && reclaim.shrinkers[i-1].cost > cost; i--)
+    reclaim.shrinkers[i] = reclaim.shrinkers[i-1];
+  reclaim.shrinkers[i].name = name;
+  reclaim.shrinkers[i].cost = cost;
+  reclaim.shrinkers[i].scan = scan;
+  reclaim.n++;
+}
+
+// Run the shrinkers, cheapest first, until npages pages have
+// been freed. Returns the number of pages freed.
+int
+shrink(int npages)
+{
+  int i, freed = 0;
+
+  for(i = 0; i < reclaim.n && freed < npages; i++)
+    freed += reclaim.shrinkers[i].scan(npages - freed);
+  return freed;
+}
+
+// Called by the scheduler. Wakes kreclaimd if free memory is
+// below the low watermark.
+void
+kreclaim_wake(void)
+{
+  if(!__atomic_load_n(&reclaim.sleeping, __ATOMIC_RELAXED) ||
+     freepages() >= RECLAIM_LOW)
+    return;
+  acquire(&reclaim.lock);
+  reclaim.sleeping = 0;
+  release(&reclaim.lock);
+  wakeup(&reclaim);
+}
+
+// Kernel thread that reclaims memory in the background,
+// from the low watermark up to the high one.
+void
+kreclaimd(void)
+{
+  int n, freed;
+
+  initlock(&reclaim.lock, "reclaim");
+  for(;;){
+    acquire(&reclaim.lock);
+    reclaim.sleeping = 1;
+    while(reclaim.sleeping)
+      sleep(&reclaim, &reclaim.lock);
+    release(&reclaim.lock);
+
+    freed = 0;
+    while((n = RECLAIM_HIGH - freepages()) > 0){
+      if(shrink(n) == 0 && swapout() == 0)
+        break;
+      freed = 1;
+    }
+    if(n > 0 && !freed){
+      // nothing to reclaim. reclaim.sleeping stays clear, so
+      // kreclaim_wake() leaves kreclaimd be meanwhile.
+      acquire(&reclaim.lock);
+      sleep_timeout(0, &reclaim.lock, ticks + RECLAIM_BACKOFF);
+      release(&reclaim.lock);
+    }
+  }
+}
@@ -42,6 +42,7 @@ w_mepc(uint64 x)
 
 // Supervisor Status Register, sstatus
 
+#define SSTATUS_SUM (1L << 18) // Supervisor may access User pages
 #define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
@@ -201,6 +202,12 @@ w_pmpaddr0(uint64 x)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+// satp's address-space identifier field, 16 bits at most.
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK  0xFFFFL
+#define MAKE_SATP_ASID(pagetable, asid) \
+  (MAKE_SATP(pagetable) | ((uint64)(asid) << SATP_ASID_SHIFT))
+
 // supervisor address translation and protection;
 // holds the address of the page table.
 static inline void 
@@ -327,6 +334,20 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries for va, in every address space.
+static inline void
+sfence_vma_va(uint64 va)
+{
+  asm volatile("sfence.vma %0, zero" : : "r" (va));
+}
+
+// flush the TLB entries for va in address space asid.
+static inline void
+sfence_vma_asid(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid));
+}
+
 typedef uint64 pte_t;
 typedef uint64 *pagetable_t; // 512 PTEs
 
@@ -343,8 +364,12 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
+#define PTE_G (1L << 5) // global: the same in every address space
 
 #define PTE_A (1L << 6) 
+#define PTE_D (1L << 7) // dirty: written since mapped
+#define PTE_COW (1L << 8) // copy-on-write page (RSW bit)
+#define PTE_SWAP (1L << 9) // invalid PTE of a swapped-out page (RSW bit)
 
 // shift a physical address to the right place for a PTE.
 // PA2PTE(pa)：物理地址转换成PTE，实际上是右移12位去掉offset，然后左移10位预留flag位
@@ -354,10 +379,21 @@ typedef uint64 *pagetable_t; // 512 PTEs
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// a swap entry holds the swap slot where the PPN would be.
+#define SLOT2PTE(slot) (((uint64)(slot)) << 10)
+#define PTE2SLOT(pte) ((uint)((pte) >> 10))
+
+// a valid PTE is a leaf if it grants any of R, W or X;
+// otherwise it points to the next-level page table.
+#define PTE_LEAF(pte) (((pte) & (PTE_R|PTE_W|PTE_X)) != 0)
+
 // extract the three 9-bit page table indices from a virtual address.
 // 下面三个宏用于从虚拟地址中提取三个9位的索引
 #define PXMASK          0x1FF // 9 bits
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
+// bytes mapped by a leaf PTE at level 0 (4 KiB), level 1
+// (2 MiB megapage) or level 2 (1 GiB gigapage).
+#define LEVELSIZE(level) (1L << PXSHIFT(level))
 // PX(level, va)：从虚拟地址va中提取出第level级页表索引
 #define PX(level, va) ((((uint64) (va)) >> PXSHIFT(level)) & PXMASK)
 
@@ -0,0 +1,356 @@
+// Per-CPU run queues.
+//
+// Each hart has a queue of RUNNABLE processes, so that the
+// scheduler finds the next process to run without scanning
+// proc[] and taking every p->lock. setrunnable() puts a
+// process at the tail of the queue of the hart that last ran
+// it, p->cpu, whose caches are most likely to still hold its
+// memory, unless wakeup() woke p and p->cpu is busy while
+// another hart idles: then p moves to the idle hart, which
+// setrunnable() kicks (see timer.c). The scheduler takes from
+// the head of its own queue.
+// A hart whose queue is empty steals from the longest queue
+// of another hart. Queue lengths are read without locking,
+// so choosing where to steal from takes no locks.
+//
+// The policy is chosen at build time, make SCHEDPOLICY=...:
+//
+//  - RR, the default: round robin, one tick at a time.
+//  - MLFQ: a multi-level feedback queue. Each queue has NPRIO
+//    levels, 0 first. A process runs QUANTUM(prio) ticks at a
+//    level before it moves one down, and is preempted as soon
+//    as a process of a higher level is waiting. One woken from
+//    sleep(), mostly by I/O, is taken as interactive: it moves
+//    one level up and starts a fresh slice. Every BOOSTTICKS
+//    ticks all processes go back to the top, so those at the
+//    bottom do not starve. setpriority() sets p->basepri, the
+//    highest level p may run at; NPRIO-1 pins batch work to
+//    the bottom.
+//  - STRIDE: stride scheduling. Each process has p->tickets,
+//    set by settickets(), and a pass, which every tick it runs
+//    advances by its stride, STRIDE1 / tickets; each queue is
+//    a heap ordered by pass, and the process with the lowest
+//    pass runs next, for one tick. So processes on a hart get
+//    its time in proportion to their tickets, each within a
+//    tick or so of its share. A process that is queued again
+//    after sleeping starts no earlier than the pass of the
+//    last process the hart picked, so it cannot save up time.
+//
+// Lock order: p->lock, then a queue's lock. runq_take()
+// removes a process from its queue before it acquires
+// p->lock. A RUNNABLE process that is on no queue belongs to
+// the hart that took it, so nothing changes it in between;
+// the hart that queued it may still be switching away from it,
+// but it holds p->lock until swtch() is done, so runq_take()
+// waits for that. While p is queued, its queue's lock
+// protects p->prio, p->slice and p->pass; otherwise they
+// belong to the hart that runs or queues p.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "cpustat.h"
+#include "defs.h"
+
+#if defined(SCHED_RR) + defined(SCHED_MLFQ) + defined(SCHED_STRIDE) != 1
+#error "SCHEDPOLICY must be RR, MLFQ or STRIDE"
+#endif
+
+#define BOOSTTICKS     50             // MLFQ: all processes back to the top this often
+#define QUANTUM(prio)  (1 << (prio))  // MLFQ: ticks at prio before moving down
+#define STRIDE1        (1 << 20)      // STRIDE: stride of a process with one ticket
+#define MAXTICKETS     (1 << 16)
+
+extern struct cpustat cpustat[NCPU];
+
+struct runq {
+  struct spinlock lock;
+#ifdef SCHED_STRIDE
+  struct proc *heap[NPROC];   // RUNNABLE processes, a min-heap on p->pass
+  uint64 pass;                // pass of the process picked last
+#else
+  struct proc *head[NPRIO];   // RUNNABLE processes of each level,
+  struct proc *tail[NPRIO];   //   oldest first, linked through p->rqnext
+#endif
+  int n;                      // processes on the queue
+} runq[NCPU];
+
+#ifdef SCHED_MLFQ
+static uint boostgen;         // boosts so far
+#endif
+
+void
+runqinit(void)
+{
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+}
+
+#ifdef SCHED_STRIDE
+// Add p to q's heap.
+// Caller must hold q->lock.
+static void
+enqueue(struct runq *q, struct proc *p)
+{
+  int i, parent;
+
+  if(p->pass < q->pass)
+    p->pass = q->pass;
+  for(i = q->n; i > 0; i = parent){
+    parent = (i - 1) / 2;
+    if(q->heap[parent]->pass <= p->pass)
+      break;
+    q->heap[i] = q->heap[parent];
+  }
+  q->heap[i] = p;
+  __atomic_store_n(&q->n, q->n + 1, __ATOMIC_RELAXED);
+}
+
+// Remove the process with the lowest pass from q, if any.
+// Caller must hold q->lock.
+static struct proc*
+pop(struct runq *q)
+{
+  struct proc *p, *last;
+  int i, c, n = q->n - 1;
+
+  if(q->n == 0)
+    return 0;
+  p = q->heap[0];
+  last = q->heap[n];
+  for(i = 0; (c = 2*i + 1) < n; i = c){
+    if(c + 1 < n && q->heap[c+1]->pass < q->heap[c]->pass)
+      c++;
+    if(q->heap[c]->pass >= last->pass)
+      break;
+    q->heap[i] = q->heap[c];
+  }
+  q->heap[i] = last;
+  __atomic_store_n(&q->n, n, __ATOMIC_RELAXED);
+  q->pass = p->pass;
+  return p;
+}
+#else
+// Put p at the tail of its level of q.
+// Caller must hold q->lock.
+static void
+enqueue(struct runq *q, struct proc *p)
+{
+  int l = p->prio;
+
+  p->rqnext = 0;
+  if(q->tail[l])
+    q->tail[l]->rqnext = p;
+  else
+    q->head[l] = p;
+  q->tail[l] = p;
+  __atomic_store_n(&q->n, q->n + 1, __ATOMIC_RELAXED);
+}
+
+// Remove the first process of the highest non-empty level of
+// q, if any.
+// Caller must hold q->lock.
+static struct proc*
+pop(struct runq *q)
+{
+  struct proc *p;
+
+  for(int l = 0; l < NPRIO; l++){
+    if((p = q->head[l]) != 0){
+      if((q->head[l] = p->rqnext) == 0)
+        q->tail[l] = 0;
+      __atomic_store_n(&q->n, q->n - 1, __ATOMIC_RELAXED);
+      return p;
+    }
+  }
+  return 0;
+}
+#endif
+
+#ifdef SCHED_MLFQ
+// Bring p's level up to date: a boost since p was last queued
+// or charged a tick puts it back at the top, and it never
+// runs above p->basepri.
+static void
+mlfq_update(struct proc *p)
+{
+  uint gen = __atomic_load_n(&boostgen, __ATOMIC_RELAXED);
+
+  if(p->boostgen != gen){
+    p->boostgen = gen;
+    p->prio = 0;
+    p->slice = 0;
+  }
+  if(p->prio < p->basepri){
+    p->prio = p->basepri;
+    p->slice = 0;
+  }
+}
+#endif
+
+// Make p RUNNABLE and put it on a run queue.
+// Caller must hold p->lock.
+void
+setrunnable(struct proc *p)
+{
+  struct runq *q;
+
+  if(!holding(&p->lock))
+    panic("setrunnable");
+#ifdef SCHED_MLFQ
+  mlfq_update(p);
+  if(p->state == SLEEPING){
+    // woken up: interactive.
+    if(p->prio > p->basepri)
+      p->prio--;
+    p->slice = 0;
+  }
+#endif
+  if(p->state == SLEEPING){
+    p->wakets = r_time();
+    // rather than wait for a busy hart, run on an idle one.
+    p->cpu = idle_pick(p->cpu);
+  }
+  p->state = RUNNABLE;
+  q = &runq[p->cpu];
+  acquire(&q->lock);
+  enqueue(q, p);
+  release(&q->lock);
+  idle_kick(p->cpu);
+}
+
+// Remove the process that should run next from q, if any.
+static struct proc*
+dequeue(struct runq *q)
+{
+  struct proc *p;
+
+  acquire(&q->lock);
+  p = pop(q);
+  release(&q->lock);
+  return p;
+}
+
+// Take the next process to run off this hart's run queue, or
+// steal one from the hart with the longest queue. Returns it
+// with p->lock held, or 0 if there is none.
+// Called by the scheduler.
+struct proc*
+runq_take(void)
+{
+  int id = cpuid(), i, n, max = 0;
+  struct proc *p;
+  struct runq *busiest = 0;
+
+  if((p = dequeue(&runq[id])) == 0){
+    for(i = 0; i < NCPU; i++){
+      n = __atomic_load_n(&runq[i].n, __ATOMIC_RELAXED);
+      if(i != id && n > max){
+        max = n;
+        busiest = &runq[i];
+      }
+    }
+    // another hart may have emptied it meanwhile.
+    if(busiest == 0 || (p = dequeue(busiest)) == 0)
+      return 0;
+    cpustat[id].nsteal++;
+  }
+  acquire(&p->lock);
+  if(p->state != RUNNABLE)
+    panic("runq_take");
+  p->cpu = id;
+  if(p->wakets){
+    // how long it waited to run after wakeup().
+    cpustat[id].nwakeup++;
+    cpustat[id].wakelat += r_time() - p->wakets;
+    p->wakets = 0;
+  }
+  return p;
+}
+
+// Number of processes waiting on hart id's run queue, read
+// without locking.
+int
+runq_len(int id)
+{
+  return __atomic_load_n(&runq[id].n, __ATOMIC_RELAXED);
+}
+
+// Charge a timer tick to p, the process running on this hart.
+// Returns 1 if p should yield the CPU.
+int
+runq_tick(struct proc *p)
+{
+#ifdef SCHED_MLFQ
+  struct runq *q = &runq[cpuid()];
+
+  mlfq_update(p);
+  if(++p->slice >= QUANTUM(p->prio)){
+    // used up its slice: one level down.
+    if(p->prio < NPRIO-1)
+      p->prio++;
+    p->slice = 0;
+    return 1;
+  }
+  for(int l = 0; l < p->prio; l++)
+    if(__atomic_load_n(&q->head[l], __ATOMIC_RELAXED))
+      return 1;
+  return 0;
+#elif defined(SCHED_STRIDE)
+  p->pass += p->stride;
+  return 1;
+#else
+  return 1;
+#endif
+}
+
+// Called by clockintr() when ticks moves on from old to t,
+// which may be more than one tick later if all harts were
+// idle. Under MLFQ, every BOOSTTICKS ticks puts the queued
+// processes back at the top now, and the others when they are
+// next queued or charged a tick.
+void
+runq_clock(uint old, uint t)
+{
+#ifdef SCHED_MLFQ
+  struct runq *q;
+  struct proc *p, *next;
+  uint gen;
+
+  if(old / BOOSTTICKS == t / BOOSTTICKS)
+    return;
+  gen = __atomic_add_fetch(&boostgen, 1, __ATOMIC_RELAXED);
+  for(q = runq; q < &runq[NCPU]; q++){
+    acquire(&q->lock);
+    for(int l = 0; l < NPRIO; l++){
+      p = q->head[l];
+      q->head[l] = q->tail[l] = 0;
+      for(; p; p = next){
+        next = p->rqnext;
+        p->boostgen = gen;
+        p->prio = p->basepri;
+        p->slice = 0;
+        q->n--;
+        enqueue(q, p);
+      }
+    }
+    release(&q->lock);
+  }
+#endif
+}
+
+// Give p n tickets, its share of CPU time under stride
+// scheduling. Returns 0, or -1 if n is out of range.
+// p must be the current process, or new.
+int
+settickets(struct proc *p, int n)
+{
+  if(n < 1 || n > MAXTICKETS)
+    return -1;
+  p->tickets = n;
+  p->stride = STRIDE1 / n;
+  return 0;
+}
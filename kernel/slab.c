@@ -0,0 +1,260 @@
+// Slab allocator for small fixed-size kernel objects.
+//
+// Each object type gets a kmem_cache. A cache carves whole
+// pages from kalloc() into slabs of equally sized objects,
+// so objects are packed densely instead of using a page
+// each. A slab starts with a header holding the free-object
+// index list; objects follow it. Because the free list lives
+// in the header, the objects themselves are never written
+// by the allocator, and state set up by the cache's
+// constructor (locks, for instance) survives free/alloc
+// cycles: the constructor runs once per object, when its
+// slab is created.
+//
+// Each CPU has a small magazine of objects per cache, so the
+// common alloc/free is O(1) and takes no lock. Magazines are
+// refilled from, and flushed to, the slabs in batches of
+// MAGSIZE/2 objects under the cache lock.
+//
+// Each cache keeps one empty slab for reuse; under memory
+// pressure, the slab shrinker gives those back to kalloc().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "sysinfo.h"
+#include "defs.h"
+
+#define NCACHE   16   // maximum number of caches
+#define MAGSIZE  16   // objects in a per-CPU magazine
+
+struct slab {
+  struct slab *next;        // on the cache's partial or full list
+  struct slab *prev;
+  struct kmem_cache *cache;
+  int inuse;                // allocated objects
+  int free;                 // index of first free object, or -1
+  char *objs;               // first object
+  short nextfree[];         // free list: index of the next free object
+};
+
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+} __attribute__((aligned(64)));
+
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint size;                // object size, rounded up to 8 bytes
+  int perslab;              // objects per slab
+  void (*ctor)(void*);
+  struct slab partial;      // slabs with free and allocated objects
+  struct slab full;         // slabs with no free objects
+  struct slab *empty;       // at most one unused slab kept for reuse
+  uint64 nslabs;            // pages held by this cache
+  struct magazine mag[NCPU];
+};
+
+static struct kmem_cache caches[NCACHE];
+static int ncaches;
+
+static void
+slab_unlink(struct slab *s)
+{
+  s->prev->next = s->next;
+  s->next->prev = s->prev;
+}
+
+static void
+slab_link(struct slab *head, struct slab *s)
+{
+  s->next = head->next;
+  s->prev = head;
+  head->next->prev = s;
+  head->next = s;
+}
+
+// Shrinker: free the empty slabs that caches keep for reuse.
+// kalloc() may be called with a cache's lock held, from
+// slab_grow(), so skip caches whose lock is busy.
+static int
+slab_shrink(int npages)
+{
+  struct kmem_cache *c;
+  int n = 0;
+
+  for(c = caches; c < &caches[ncaches] && n < npages; c++){
+    if(!tryacquire(&c->lock))
+      continue;
+    if(c->empty){
+      kfree(c->empty);
+      c->empty = 0;
+      c->nslabs--;
+      n++;
+    }
+    release(&c->lock);
+  }
+  return n;
+}
+
+void
+slabinit(void)
+{
+  shrinker_register("slab", 2, slab_shrink);
+}
+
+// Create a cache of objects of the given size. ctor, if not
+// zero, is run on every object when its slab is created.
+// Caches live forever.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size, void (*ctor)(void*))
+{
+  struct kmem_cache *c;
+  int i, hdr;
+
+  i = __sync_fetch_and_add(&ncaches, 1);
+  if(i >= NCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &caches[i];
+
+  size = (size + 7) & ~7;
+  // objects per slab, leaving room for the header and its
+  // free-list entry per object.
+  c->perslab = (PGSIZE - sizeof(struct slab)) / (size + sizeof(short));
+  hdr = (sizeof(struct slab) + c->perslab * sizeof(short) + 7) & ~7;
+  while(hdr + c->perslab * size > PGSIZE){
+    c->perslab--;
+    hdr = (sizeof(struct slab) + c->perslab * sizeof(short) + 7) & ~7;
+  }
+  if(c->perslab < 1)
+    panic("kmem_cache_create: object too big");
+
+  initlock(&c->lock, name);
+  lockstat_register(&c->lock);
+  c->name = name;
+  c->size = size;
+  c->ctor = ctor;
+  c->partial.next = c->partial.prev = &c->partial;
+  c->full.next = c->full.prev = &c->full;
+  return c;
+}
+
+// Get a slab with a free object: a partial one, the cached
+// empty one, or a newly allocated one. Returns 0 if out of
+// memory. Caller must hold c->lock.
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  int i;
+
+  if(c->partial.next != &c->partial)
+    return c->partial.next;
+
+  if((s = c->empty) != 0){
+    c->empty = 0;
+  } else {
+    if((s = kalloc(KM_SLAB)) == 0)
+      return 0;
+    c->nslabs++;
+    s->cache = c;
+    s->inuse = 0;
+    s->objs = (char*)s + ((sizeof(struct slab) + c->perslab * sizeof(short) + 7) & ~7);
+    for(i = 0; i < c->perslab; i++){
+      s->nextfree[i] = i + 1 < c->perslab ? i + 1 : -1;
+      if(c->ctor)
+        c->ctor(s->objs + i * c->size);
+    }
+    s->free = 0;
+  }
+  slab_link(&c->partial, s);
+  return s;
+}
+
+// Take one object from the slabs. Caller must hold c->lock.
+static void*
+slab_get(struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  if((s = slab_grow(c)) == 0)
+    return 0;
+  obj = s->objs + s->free * c->size;
+  s->free = s->nextfree[s->free];
+  if(++s->inuse == c->perslab){
+    slab_unlink(s);
+    slab_link(&c->full, s);
+  }
+  return obj;
+}
+
+// Return one object to its slab. Caller must hold c->lock.
+static void
+slab_put(struct kmem_cache *c, void *obj)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint64)obj);
+  int i = ((char*)obj - s->objs) / c->size;
+
+  if(s->cache != c || (char*)obj != s->objs + i * c->size)
+    panic("kmem_cache_free");
+
+  if(s->inuse-- == c->perslab){
+    slab_unlink(s);
+    slab_link(&c->partial, s);
+  }
+  s->nextfree[i] = s->free;
+  s->free = i;
+
+  if(s->inuse == 0){
+    slab_unlink(s);
+    if(c->empty == 0){
+      c->empty = s;
+    } else {
+      c->nslabs--;
+      kfree(s);
+    }
+  }
+}
+
+// Allocate an object from cache c.
+// Returns 0 if out of memory.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  void *obj = 0;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    while(m->n < MAGSIZE/2 && (obj = slab_get(c)) != 0)
+      m->obj[m->n++] = obj;
+    release(&c->lock);
+  }
+  obj = m->n > 0 ? m->obj[--m->n] : 0;
+  pop_off();
+  return obj;
+}
+
+// Return obj, which must have come from cache c.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct magazine *m;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    while(m->n > MAGSIZE/2)
+      slab_put(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = obj;
+  pop_off();
+}
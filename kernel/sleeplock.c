@@ -36,7 +36,8 @@ releasesleep(struct sleeplock *lk)
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  // only one waiter can get the lock.
+  wakeup_one(lk);
   release(&lk->lk);
 }
 
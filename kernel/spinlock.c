@@ -7,6 +7,12 @@
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
+#include "lockstat.h"
+
+// long-lived locks whose counters lockstat() reports.
+#define NLOCKSTAT 32
+static struct spinlock *statlocks[NLOCKSTAT];
+static int nstatlocks;
 
 void
 initlock(struct spinlock *lk, char *name)
@@ -14,6 +20,8 @@ initlock(struct spinlock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->n = 0;
+  lk->nts = 0;
 }
 
 // Acquire the lock.
@@ -21,6 +29,8 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint64 spins = 0;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
@@ -29,8 +39,11 @@ acquire(struct spinlock *lk)
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
+  // failed attempts are counted here, and added to lk->nts
+  // once the lock is held, so that counting them does not
+  // write to the lock's cache line while others want it.
   while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+    spins++;
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +53,25 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+  lk->n++;
+  lk->nts += spins;
+}
+
+// Acquire the lock if it is free, without spinning.
+// Returns 1 if it was acquired, 0 if it is held, also if
+// by this CPU.
+int
+tryacquire(struct spinlock *lk)
+{
+  push_off();
+  if(holding(lk) || __sync_lock_test_and_set(&lk->locked, 1) != 0){
+    pop_off();
+    return 0;
+  }
+  __sync_synchronize();
+  lk->cpu = mycpu();
+  lk->n++;
+  return 1;
 }
 
 // Release the lock.
@@ -108,3 +140,34 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+// Make lk's counters visible through lockstat().
+// lk must never be freed.
+void
+lockstat_register(struct spinlock *lk)
+{
+  int i = __sync_fetch_and_add(&nstatlocks, 1);
+
+  if(i >= NLOCKSTAT)
+    panic("lockstat_register");
+  statlocks[i] = lk;
+}
+
+// Copy the counters of up to max registered locks to the
+// user address addr. Returns the number copied, or -1.
+int
+lockstat_copyout(uint64 addr, int max)
+{
+  struct lockstat ls;
+  int i;
+
+  for(i = 0; i < nstatlocks && i < max; i++){
+    struct spinlock *lk = statlocks[i];
+    safestrcpy(ls.name, lk->name, sizeof(ls.name));
+    ls.n = lk->n;
+    ls.nts = lk->nts;
+    if(copyout(myproc()->pagetable, addr + i*sizeof(ls), (char*)&ls, sizeof(ls)) < 0)
+      return -1;
+  }
+  return i;
+}
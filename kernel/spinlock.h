@@ -5,5 +5,8 @@ struct spinlock {
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
-};
 
+  // For lockstat():
+  uint64 n;          // Number of times acquired.
+  uint64 nts;        // Number of failed test-and-sets while waiting.
+};
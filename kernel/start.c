@@ -13,7 +13,7 @@ __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
 // a scratch area per CPU for machine-mode timer interrupts.
 // 为每个cpu在机器模式下的定时中断分配一个暂存区域
-uint64 timer_scratch[NCPU][5];
+uint64 timer_scratch[NCPU][6];
 
 // assembly code in kernelvec.S for machine-mode timer interrupt.
 // 这个是机器模式下的定时中断处理函数，定义在kernelvec.S
@@ -47,6 +47,9 @@ start()
   w_mideleg(0xffff);
   w_sie(r_sie() | SIE_SEIE | SIE_STIE | SIE_SSIE);
 
+  // let supervisor mode read the time CSR.
+  w_mcounteren(r_mcounteren() | 2);
+
   // configure Physical Memory Protection to give supervisor mode
   // access to all of physical memory.
   w_pmpaddr0(0x3fffffffffffffull);
@@ -83,22 +86,25 @@ timerinit()
   // 每个cpu都有它自己的定时中断
   int id = r_mhartid();
 
-  // ask the CLINT for a timer interrupt.
-  // 请求CLINT给一个定时中断
-  int interval = 1000000; // cycles; about 1/10th second in qemu. 周期；在qemu里，大概1/10秒
-  *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
+  // ask the CLINT for a timer interrupt at the next tick
+  // boundary. after that, timerintr() in timer.c decides
+  // when the next one is.
+  // 请求CLINT在下一个tick边界给一个定时中断
+  uint64 now = *(uint64*)CLINT_MTIME;
+  *(uint64*)CLINT_MTIMECMP(id) = (now / TICKCYCLES + 1) * TICKCYCLES;
 
   // prepare information in scratch[] for timervec.
   // scratch[0..2] : space for timervec to save registers.
   // scratch[3] : address of CLINT MTIMECMP register.
-  // scratch[4] : desired interval (in cycles) between timer interrupts.
+  // scratch[4] : address of CLINT MSIP register, for IPIs.
+  // scratch[5] : set by timervec on a timer interrupt, for timertick().
   // 为timervec准备信息在scratch[]
   // scratch[0..2] : 用来给timervec保存寄存器
   // scratch[3] : CLINT MTIMECMP 寄存器地址
-  // scratch[4] : 保存定时中断之间的间隔（周期数）
   uint64 *scratch = &timer_scratch[id][0];
   scratch[3] = CLINT_MTIMECMP(id);
-  scratch[4] = interval;
+  scratch[4] = CLINT_MSIP(id);
+  scratch[5] = 0;
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
@@ -109,7 +115,17 @@ timerinit()
   // 启用机器模式下的所有中断
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-  // enable machine-mode timer interrupts.
-  // 启用机器模式下的定时中断
-  w_mie(r_mie() | MIE_MTIE);
+  // enable machine-mode timer interrupts, and software
+  // interrupts, which other harts send as IPIs.
+  // 启用机器模式下的定时中断和软件中断(IPI)
+  w_mie(r_mie() | MIE_MTIE | MIE_MSIE);
+}
+
+// Whether a timer interrupt has arrived on this hart since
+// the last call: timervec turns both timer interrupts and IPIs
+// into supervisor software interrupts. Called by devintr().
+int
+timertick(void)
+{
+  return __atomic_exchange_n(&timer_scratch[cpuid()][5], 0, __ATOMIC_RELAXED) != 0;
 }
@@ -0,0 +1,298 @@
+// Swapping of user pages to disk.
+//
+// mkfs reserves NSWAP blocks after the file system as a swap
+// area; the superblock records where. The area is divided
+// into page-sized slots. When memory runs out, kalloc_user()
+// calls swapout(), which picks a cold user page, writes it to
+// a free slot, and replaces its PTE with a swap entry: an
+// invalid PTE with PTE_SWAP set, the slot number in place of
+// the physical page number, and the page's permission bits.
+// A later fault on the page, from usertrap() or from a copy
+// by the kernel, calls swapin() through uvmfault().
+//
+// swapout() picks victims with the clock algorithm, using the
+// accessed bit that the hardware sets in the PTE: a hand
+// sweeps over the processes' user pages, clearing PTE_A, and
+// takes the first page whose PTE_A is already clear. Only
+// private pages that nothing else refers to are candidates;
+// copy-on-write pages shared after fork, the zero page,
+// MAP_SHARED areas, and megapages (see vm.c) are skipped. Pages of a process that is
+// running on another hart are skipped too, since its TLB may
+// still map them; for a process that is not running,
+// tlb_flush() removes the page from the TLBs of harts that ran
+// it.
+//
+// A swapped page can be shared by fork(): each slot has a
+// reference count, and uvmcopy() copies the swap entry and
+// takes a reference. Each process reads the slot into its
+// own page on its first fault.
+//
+// Disk I/O goes through one buffer, outside the buffer cache,
+// serialized by a sleep-lock that swapout() holds from picking
+// the victim until the slot is written, so a fault on the page
+// cannot read the slot before it is complete.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "buf.h"
+#include "fcntl.h"
+#include "sysinfo.h"
+#include "defs.h"
+
+#define SLOTBLOCKS (PGSIZE / BSIZE)
+#define NSLOT      (NSWAP / SLOTBLOCKS)
+
+extern struct proc proc[NPROC];
+
+struct {
+  struct spinlock lock;     // protects ref[] and next
+  uchar ref[NSLOT];         // references to each slot; 0 if free
+  int nslot;
+  int nused;                // slots with references
+  int next;                 // where to start looking for a free slot
+
+  struct sleeplock io;      // protects buf and the clock hand
+  struct buf buf;
+  uint dev;
+  uint start;               // first block of the swap area
+  int hand;                 // clock hand: proc[hand], at address handva
+  uint64 handva;
+
+  uint64 nswapin;
+  uint64 nswapout;
+} swap;
+
+// Set up swapping to the swap area described by sb, if any.
+void
+swapinit(int dev, struct superblock *sb)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.io, "swapio");
+  swap.dev = dev;
+  swap.start = sb->swapstart;
+  swap.nslot = sb->nswap / SLOTBLOCKS;
+  if(swap.nslot > NSLOT)
+    swap.nslot = NSLOT;
+}
+
+// Allocate a slot, with one reference. Returns -1 if the swap
+// area is full.
+static int
+slotalloc(void)
+{
+  int i, s;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot; i++){
+    s = (swap.next + i) % swap.nslot;
+    if(swap.ref[s] == 0){
+      swap.ref[s] = 1;
+      swap.nused++;
+      swap.next = s + 1;
+      release(&swap.lock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Add a reference to slot, for fork().
+void
+swapdup(uint slot)
+{
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0 || swap.ref[slot] == 255)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to slot; the slot is free when the last
+// one is gone.
+void
+swapfree(uint slot)
+{
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0)
+    panic("swapfree");
+  if(--swap.ref[slot] == 0)
+    swap.nused--;
+  release(&swap.lock);
+}
+
+// Read or write the page at pa from or to slot.
+// Caller must hold swap.io.
+static void
+swapio(uint slot, char *pa, int write)
+{
+  struct buf *b = &swap.buf;
+
+  for(int i = 0; i < SLOTBLOCKS; i++){
+    b->dev = swap.dev;
+    b->blockno = swap.start + slot*SLOTBLOCKS + i;
+    if(write)
+      memmove(b->data, pa + i*BSIZE, BSIZE);
+    virtio_disk_rw(b, write);
+    if(!write)
+      memmove(pa + i*BSIZE, b->data, BSIZE);
+  }
+}
+
+// Advance the clock hand over p's user pages, clearing accessed
+// bits, to the next page that may be swapped out, and return
+// its PTE; or return 0 at the end of p's address space.
+// Caller must hold p->lock and swap.io.
+static pte_t *
+swapscan(struct proc *p)
+{
+  struct vma *v;
+  pte_t *pte;
+  uint64 va;
+  int level;
+
+  for(; swap.handva < MAXUVA; swap.handva += PGSIZE){
+    va = swap.handva;
+    level = 0;
+    if((pte = walk_level(p->pagetable, va, &level, 0)) == 0 || level != 0){
+      // no page-table page, or a megapage: skip the whole 2 MiB.
+      swap.handva = (va & ~(LEVELSIZE(1) - 1)) + LEVELSIZE(1) - PGSIZE;
+      continue;
+    }
+    if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+      continue;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      continue;
+    }
+    if(krefcount((void*)PTE2PA(*pte)) != 1)
+      continue;
+    if((v = vma_find(p->vma, va)) != 0 && (v->flags & MAP_SHARED))
+      continue;
+    swap.handva += PGSIZE;
+    return pte;
+  }
+  return 0;
+}
+
+// Write one cold user page out to swap and free it.
+// Returns 1 if a page was freed, 0 if there is nothing to
+// swap out or no room in the swap area.
+// Sleeps, so the caller must not hold a spinlock.
+int
+swapout(void)
+{
+  struct proc *p;
+  pte_t *pte;
+  uint64 pa;
+  int n, slot;
+  struct tlbbatch b;
+
+  if(swap.nslot == 0)
+    return 0;
+  acquiresleep(&swap.io);
+  // visit each process twice: a page whose accessed bit the
+  // first visit cleared can be taken on the second.
+  for(n = 0; n <= 2*NPROC; n++){
+    p = &proc[swap.hand];
+    acquire(&p->lock);
+    if(p->pagetable && p->kfn == 0 &&
+       (p->state == SLEEPING || p->state == RUNNABLE || p == myproc()) &&
+       (pte = swapscan(p)) != 0){
+      if((slot = slotalloc()) < 0){
+        release(&p->lock);
+        break;
+      }
+      pa = PTE2PA(*pte);
+      *pte = SLOT2PTE(slot) | (PTE_FLAGS(*pte) & ~(PTE_V|PTE_A|PTE_D)) | PTE_SWAP;
+      // harts may still hold p's translation for the page.
+      // swapscan() left the hand just past the page.
+      tlb_begin(&b, p);
+      tlb_add(&b, swap.handva - PGSIZE);
+      release(&p->lock);
+      tlb_flush(&b);
+
+      swapio(slot, (char*)pa, 1);
+      releasesleep(&swap.io);
+      kfree((void*)pa);
+      __sync_fetch_and_add(&swap.nswapout, 1);
+      return 1;
+    }
+    release(&p->lock);
+    swap.hand = (swap.hand + 1) % NPROC;
+    swap.handva = 0;
+  }
+  releasesleep(&swap.io);
+  return 0;
+}
+
+// Read the page whose swap entry is *pte back into memory
+// and map it there.
+// Returns 0, or -1 if there is no memory.
+int
+swapin(pte_t *pte)
+{
+  uint slot = PTE2SLOT(*pte);
+  char *mem;
+
+  // only the process itself changes its swap entries, so the
+  // entry stays put while kalloc_user() sleeps.
+  if((mem = kalloc_user(0)) == 0)
+    return -1;
+  acquiresleep(&swap.io);
+  swapio(slot, mem, 0);
+  releasesleep(&swap.io);
+  *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_V;
+  swapfree(slot);
+  __sync_fetch_and_add(&swap.nswapin, 1);
+  return 0;
+}
+
+// Allocate a page for user memory, zeroed if zero is set.
+// When memory is short, swap out pages to make room.
+// Returns 0 if there is no memory and nothing to swap out.
+// Sleeps, so the caller must not hold a spinlock.
+void *
+kalloc_user(int zero)
+{
+  void *mem;
+
+  for(;;){
+    if((mem = zero ? kalloc_zeroed(KM_USER) : kalloc(KM_USER)) != 0)
+      return mem;
+    if(swapout() == 0)
+      return 0;
+  }
+}
+
+// Swap out pages until at least npages pages are free, or
+// nothing more can be swapped out. For callers, like fork(),
+// that must then allocate while holding a spinlock.
+void
+swapreserve(int npages)
+{
+  while(get_free_mem() < (uint64)npages*PGSIZE && swapout())
+    ;
+}
+
+// Pages swapped in and out since boot.
+void
+swapstat(uint64 *nin, uint64 *nout)
+{
+  *nin = __atomic_load_n(&swap.nswapin, __ATOMIC_RELAXED);
+  *nout = __atomic_load_n(&swap.nswapout, __ATOMIC_RELAXED);
+}
+
+// Pages of swap space, and how many are in use.
+void
+swapspace(uint64 *total, uint64 *used)
+{
+  *total = swap.nslot;
+  *used = __atomic_load_n(&swap.nused, __ATOMIC_RELAXED);
+}
@@ -103,6 +103,14 @@ extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
 extern uint64 sys_trace(void);
 extern uint64 sys_sysinfo(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_sysinfo_ext(void);
+extern uint64 sys_cpustat(void);
+extern uint64 sys_setpriority(void);
+extern uint64 sys_getpriority(void);
+extern uint64 sys_settickets(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -130,6 +138,14 @@ static uint64 (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_trace]   sys_trace,
 [SYS_sysinfo] sys_sysinfo,
+[SYS_lockstat] sys_lockstat,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_sysinfo_ext] sys_sysinfo_ext,
+[SYS_cpustat] sys_cpustat,
+[SYS_setpriority] sys_setpriority,
+[SYS_getpriority] sys_getpriority,
+[SYS_settickets] sys_settickets,
 };
 
 
@@ -157,6 +173,14 @@ static char *syscall_names[] = {
     [SYS_close] "close",
     [SYS_trace] "trace",
     [SYS_sysinfo] "sys_sysinfo",
+    [SYS_lockstat] "lockstat",
+    [SYS_mmap] "mmap",
+    [SYS_munmap] "munmap",
+    [SYS_sysinfo_ext] "sysinfo_ext",
+    [SYS_cpustat] "cpustat",
+    [SYS_setpriority] "setpriority",
+    [SYS_getpriority] "getpriority",
+    [SYS_settickets] "settickets",
 }; // 系统调用号与名字的关系
 
 void
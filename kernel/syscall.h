@@ -22,3 +22,11 @@
 #define SYS_close  21
 #define SYS_trace  22
 #define SYS_sysinfo 23
+#define SYS_lockstat 24
+#define SYS_mmap   25
+#define SYS_munmap 26
+#define SYS_sysinfo_ext 27
+#define SYS_cpustat 28
+#define SYS_setpriority 29
+#define SYS_getpriority 30
+#define SYS_settickets 31
@@ -3,4 +3,39 @@
 struct sysinfo {
   uint64 freemem;   // 空闲内存数量（字节）
   uint64 nproc;     // 进程数
+  uint64 nswapin;   // pages swapped in since boot
+  uint64 nswapout;  // pages swapped out since boot
+};
+
+// Tags of kalloc() allocations: what a page is used for.
+#define KM_OTHER      0   // everything else, e.g. exec arguments
+#define KM_USER       1   // user memory
+#define KM_PAGETABLE  2   // user and kernel page-table pages
+#define KM_KSTACK     3   // kernel stacks
+#define KM_TRAPFRAME  4   // trapframes
+#define KM_SLAB       5   // slab caches: pipes, files, inodes
+#define KM_DEVICE     6   // device rings
+#define NKMTAG        7
+
+// sysinfo_ext() fills in as much of this as the caller's
+// buffer holds, and sets version and size, so that programs
+// built against an older or newer version still work. New
+// fields go at the end, with a new version number.
+#define SYSINFO_VERSION 2
+
+struct sysinfo_ext {
+  uint version;         // SYSINFO_VERSION of the kernel
+  uint size;            // bytes the kernel filled in
+  uint64 totalmem;      // bytes managed by the page allocator
+  uint64 freemem;       // bytes free
+  uint64 zeropool;      // bytes free and already zeroed
+  uint64 nproc;         // processes
+  uint64 swaptotal;     // bytes of swap space
+  uint64 swapused;      // bytes of swap space in use
+  uint64 nswapin;       // pages swapped in since boot
+  uint64 nswapout;      // pages swapped out since boot
+  uint64 ntags;         // entries of tagmem the kernel filled in
+  uint64 tagmem[NKMTAG];  // bytes allocated, by KM_ tag
+  // version 2
+  uint64 hugepages;     // bytes of user memory in 2 MiB megapages
 };
@@ -84,7 +84,7 @@ sys_sleep(void)
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    sleep_timeout(0, &tickslock, ticks0 + n);
   }
   release(&tickslock);
   return 0;
@@ -134,9 +134,106 @@ sys_sysinfo(void)
 
   info.freemem = get_free_mem();
   info.nproc = get_proc_num();
+  swapstat(&info.nswapin, &info.nswapout);
 
   if (copyout(p->pagetable, addr, (char *)&info, sizeof(info)) < 0) // 把内核空间的info拷贝到对应程序的虚拟地址空间上
     return -1;
   return 0;
 }
 
+// sysinfo_ext(struct sysinfo_ext *info, int size): copy the
+// first size bytes of the extended system information, at most
+// sizeof(struct sysinfo_ext), to user space.
+uint64
+sys_sysinfo_ext(void)
+{
+  uint64 addr;
+  int size;
+  struct sysinfo_ext info;
+  uint64 tags[NKMTAG];
+
+  argaddr(0, &addr);
+  argint(1, &size);
+  if(size < 0)
+    return -1;
+  if(size > sizeof(info))
+    size = sizeof(info);
+
+  memset(&info, 0, sizeof(info));
+  info.version = SYSINFO_VERSION;
+  info.size = size;
+  info.totalmem = get_total_pages() * PGSIZE;
+  info.freemem = get_free_mem();
+  info.zeropool = get_zpool_pages() * PGSIZE;
+  info.nproc = get_proc_num();
+  swapspace(&info.swaptotal, &info.swapused);
+  info.swaptotal *= PGSIZE;
+  info.swapused *= PGSIZE;
+  swapstat(&info.nswapin, &info.nswapout);
+  info.ntags = NKMTAG;
+  get_tag_pages(tags);
+  for(int i = 0; i < NKMTAG; i++)
+    info.tagmem[i] = tags[i] * PGSIZE;
+  info.hugepages = uvmhugepages() * LEVELSIZE(1);
+
+  if(copyout(myproc()->pagetable, addr, (char *)&info, size) < 0)
+    return -1;
+  return 0;
+}
+
+// copy spinlock contention counters to user space.
+uint64
+sys_lockstat(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return lockstat_copyout(addr, n);
+}
+
+// copy per-hart counters to user space.
+uint64
+sys_cpustat(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return cpustat_copyout(addr, n);
+}
+
+// setpriority(int pid, int prio): set the highest scheduling
+// level pid may run at.
+uint64
+sys_setpriority(void)
+{
+  int pid, prio;
+
+  argint(0, &pid);
+  argint(1, &prio);
+  return setpriority(pid, prio);
+}
+
+// getpriority(int pid): the scheduling level pid runs at.
+uint64
+sys_getpriority(void)
+{
+  int pid;
+
+  argint(0, &pid);
+  return getpriority(pid);
+}
+
+// settickets(int n): set the calling process's share of CPU
+// time under stride scheduling.
+uint64
+sys_settickets(void)
+{
+  int n;
+
+  argint(0, &n);
+  return settickets(myproc(), n);
+}
@@ -0,0 +1,226 @@
+// Timeouts, on a hierarchical timer wheel.
+//
+// A timeout asks clockintr() to call a function once ticks
+// reaches a given tick: sleep_timeout() uses one to wake a
+// sleeping process, for sys_sleep() or for a kernel wait with
+// a deadline, such as on a disk request.
+//
+// The wheel has NLEVEL levels of WHEELSIZE slots. A slot of
+// level 0 holds the timeouts that go off at one tick of the
+// next WHEELSIZE; a slot of level l holds those of a span of
+// WHEELSIZE^l ticks, further off. Each tick, clockintr() calls
+// the functions of the timeouts in one level-0 slot. When the
+// ticks of a slot of level l come up, its timeouts are
+// cascaded: placed again, now into lower levels. So adding
+// and removing a timeout take constant time, and a tick
+// touches only the timeouts due then, instead of waking
+// every sleeping process to check.
+//
+// An idle hart has no tick (see timer.c); it arms its timer
+// for wheel.next, no later than the first timeout, and ticks
+// may move on by many at once when it wakes.
+//
+// tickslock protects the wheel and the timeouts on it, and is
+// held while the functions are called, so they must not
+// sleep or acquire tickslock, and a timeout_del() that returns
+// means the function is not running and will not run.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "timeout.h"
+#include "defs.h"
+
+#define WHEELBITS  6
+#define WHEELSIZE  (1 << WHEELBITS)   // slots per level
+#define NLEVEL     4                  // the wheel spans WHEELSIZE^NLEVEL ticks
+#define LEVELSPAN(l) (1U << (WHEELBITS*(l)))  // ticks of a slot of level l
+
+struct {
+  struct timeout *slot[NLEVEL][WHEELSIZE];
+  uint clk;         // tick the wheel has been run up to
+  uint next;        // no timeout goes off before this tick
+  int n;            // timeouts on the wheel
+} wheel = { .next = ~0 };
+
+// Put to into the slot for its expiry time, or for tick
+// first if that is later. first is the next tick for a new
+// timeout, and this tick when cascading, since this tick's
+// level-0 slot is run right after.
+static void
+place(struct timeout *to, uint first)
+{
+  uint e = to->expires, delta;
+  struct timeout **s;
+  int l;
+
+  if(e < first)
+    e = first;
+  delta = e - wheel.clk;
+  for(l = 0; l < NLEVEL-1 && delta >= LEVELSPAN(l+1); l++)
+    ;
+  if(delta >= LEVELSPAN(NLEVEL))
+    e = wheel.clk + LEVELSPAN(NLEVEL) - 1;  // beyond the wheel: cascaded until due
+  s = &wheel.slot[l][(e / LEVELSPAN(l)) % WHEELSIZE];
+  to->next = *s;
+  if(*s)
+    (*s)->pprev = &to->next;
+  to->pprev = s;
+  *s = to;
+}
+
+static void
+unlink(struct timeout *to)
+{
+  *to->pprev = to->next;
+  if(to->next)
+    to->next->pprev = to->pprev;
+}
+
+// Set to's function and its argument.
+void
+timeout_init(struct timeout *to, void (*fn)(struct timeout*), void *arg)
+{
+  to->fn = fn;
+  to->arg = arg;
+  to->pending = 0;
+}
+
+// Make to go off when ticks reaches expires, or at the next
+// tick if that has passed. If to is already on the wheel,
+// it moves.
+// Caller must hold tickslock.
+void
+timeout_add(struct timeout *to, uint expires)
+{
+  if(!holding(&tickslock))
+    panic("timeout_add");
+  if(to->pending)
+    unlink(to);
+  else
+    wheel.n++;
+  to->pending = 1;
+  to->expires = expires;
+  place(to, wheel.clk + 1);
+  if(expires <= wheel.clk)
+    expires = wheel.clk + 1;
+  if(expires < wheel.next)
+    __atomic_store_n(&wheel.next, expires, __ATOMIC_RELAXED);
+}
+
+// Take to off the wheel. Returns 1 if it was on it, 0 if it
+// has gone off or was never added.
+// Caller must hold tickslock.
+int
+timeout_del(struct timeout *to)
+{
+  if(!holding(&tickslock))
+    panic("timeout_del");
+  if(!to->pending)
+    return 0;
+  unlink(to);
+  to->pending = 0;
+  wheel.n--;
+  return 1;
+}
+
+// Place again the timeouts of slot i of level l.
+static void
+cascade(int l, int i)
+{
+  struct timeout *to, *next;
+
+  to = wheel.slot[l][i];
+  wheel.slot[l][i] = 0;
+  for(; to; to = next){
+    next = to->next;
+    place(to, wheel.clk);
+  }
+}
+
+// Move the wheel on to tick t at once, when no timeout is
+// due by then, by placing every timeout again.
+static void
+rehash(uint t)
+{
+  struct timeout *all = 0, *to, *next;
+
+  for(int l = 0; l < NLEVEL; l++){
+    for(int i = 0; i < WHEELSIZE; i++){
+      for(to = wheel.slot[l][i]; to; to = next){
+        next = to->next;
+        to->next = all;
+        all = to;
+      }
+      wheel.slot[l][i] = 0;
+    }
+  }
+  wheel.clk = t;
+  for(to = all; to; to = next){
+    next = to->next;
+    place(to, wheel.clk + 1);
+  }
+}
+
+// The earliest expiry of any timeout on the wheel, or ~0.
+static uint
+earliest(void)
+{
+  struct timeout *to;
+  uint e = ~0;
+
+  for(int l = 0; l < NLEVEL; l++)
+    for(int i = 0; i < WHEELSIZE; i++)
+      for(to = wheel.slot[l][i]; to; to = to->next)
+        if(to->expires < e)
+          e = to->expires;
+  if(e != ~0 && e <= wheel.clk)
+    e = wheel.clk + 1;
+  return e;
+}
+
+// Run the wheel up to tick t, calling the functions of the
+// timeouts that are due. Called by clockintr() when ticks
+// moves on to t.
+// Caller must hold tickslock.
+void
+timeout_run(uint t)
+{
+  struct timeout *to;
+  int l, i;
+
+  if(wheel.n == 0){
+    wheel.clk = t;
+    __atomic_store_n(&wheel.next, ~0, __ATOMIC_RELAXED);
+    return;
+  }
+  if(t < wheel.next && t - wheel.clk >= WHEELSIZE){
+    // a long idle stretch, with nothing due yet.
+    rehash(t);
+    return;
+  }
+  while(wheel.clk < t){
+    wheel.clk++;
+    for(l = 1; l < NLEVEL && wheel.clk % LEVELSPAN(l) == 0; l++)
+      cascade(l, (wheel.clk / LEVELSPAN(l)) % WHEELSIZE);
+    i = wheel.clk % WHEELSIZE;
+    // to->fn() may add timeouts, but never to this slot.
+    while((to = wheel.slot[0][i]) != 0){
+      unlink(to);
+      to->pending = 0;
+      wheel.n--;
+      to->fn(to);
+    }
+  }
+  if(t >= wheel.next)
+    __atomic_store_n(&wheel.next, earliest(), __ATOMIC_RELAXED);
+}
+
+// The tick of the first timeout, or a little earlier, or ~0
+// if there are none; for an idle hart to arm its timer for.
+uint
+timeout_next(void)
+{
+  return __atomic_load_n(&wheel.next, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,11 @@
+// A timeout on the timer wheel: clockintr() calls fn(to) once
+// ticks reaches expires, unless timeout_del() takes it off
+// first. See timeout.c.
+struct timeout {
+  uint expires;                  // tick to go off at
+  void (*fn)(struct timeout*);   // called with tickslock held
+  void *arg;                     // for fn
+  int pending;                   // on the wheel
+  struct timeout *next;          // in its wheel slot's list
+  struct timeout **pprev;        //   and what points to it
+};
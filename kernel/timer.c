@@ -0,0 +1,184 @@
+// Per-hart timer interrupts, and tickless idle.
+//
+// Each hart's CLINT mtimecmp register holds the time of its
+// next timer interrupt. timervec (kernelvec.S) turns the timer
+// off when the interrupt comes, and devintr() then calls
+// timerintr(), which sets the next one. A hart that is running
+// processes asks for one at every tick boundary, a multiple of
+// TICKCYCLES, for time slices. An idle hart turns its tick off
+// and asks only for the next deadline: the first timeout on
+// the timer wheel (timeout.c), if there is one. It then sleeps
+// in wfi until that, or a device interrupt, wakes it.
+//
+// So that no one hart has to take every tick, ticks is
+// worked out from the time: clockintr() brings it up to date,
+// on whichever hart takes a timer interrupt, and on a hart
+// leaving idle.
+//
+// An idle hart must be woken when there is work for it.
+// setrunnable() queues a process that wakeup() makes RUNNABLE
+// on an idle hart if there is one (idle_pick()), and kicks
+// that hart with an IPI through its CLINT msip register
+// (idle_kick()): the supervisor software interrupt it raises
+// ends the wfi in scheduler(). Other processes, new or
+// preempted, are queued on a busy hart; on each tick, a hart
+// with processes waiting on its queue kicks one idle hart,
+// which then steals the work.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "cpustat.h"
+#include "defs.h"
+
+extern struct cpustat cpustat[NCPU];
+
+static uint64 tickbase;   // tick boundaries before ticks was 0
+
+// Start counting ticks from now.
+// Called once, by hart 0, before other harts start.
+void
+ticksinit(void)
+{
+  tickbase = r_time() / TICKCYCLES;
+}
+
+// The number of ticks since boot, going by the time.
+uint
+timer_ticks(void)
+{
+  return r_time() / TICKCYCLES - tickbase;
+}
+
+// Ask for this hart's next timer interrupt at time when;
+// -1 asks for none.
+static void
+timer_arm(uint64 when)
+{
+  *(volatile uint64*)CLINTVA_MTIMECMP(cpuid()) = when;
+}
+
+// Ask for a timer interrupt on this hart at the next tick
+// boundary.
+static void
+timer_tick(void)
+{
+  timer_arm((r_time() / TICKCYCLES + 1) * TICKCYCLES);
+}
+
+// Choose the hart to queue a process on when wakeup() makes
+// it RUNNABLE: cpu, the hart that ran it last, if that is
+// idle, since its caches may still hold the process's memory;
+// else another idle hart, so that it need not wait for cpu;
+// else cpu.
+int
+idle_pick(int cpu)
+{
+  int id;
+
+  if(__atomic_load_n(&cpus[cpu].idle, __ATOMIC_RELAXED))
+    return cpu;
+  for(int i = 1; i < NCPU; i++){
+    id = (cpu + i) % NCPU;
+    if(__atomic_load_n(&cpus[id].idle, __ATOMIC_RELAXED))
+      return id;
+  }
+  return cpu;
+}
+
+// Wake hart id with an IPI if it is idle, after queueing a
+// process for it. Returns 1 if it was idle.
+int
+idle_kick(int id)
+{
+  // only one hart kicks it, and only while it is still idle;
+  // see timer_idle() for the other side.
+  if(!__atomic_load_n(&cpus[id].idle, __ATOMIC_RELAXED) ||
+     !__atomic_exchange_n(&cpus[id].idle, 0, __ATOMIC_SEQ_CST))
+    return 0;
+  *(volatile uint32*)CLINTVA_MSIP(id) = 1;
+  cpustat[cpuid()].nkick++;
+  return 1;
+}
+
+// If this hart has processes waiting on its run queue, wake an
+// idle hart to steal one.
+static void
+kickidle(void)
+{
+  int id = cpuid();
+
+  if(runq_len(id) == 0)
+    return;
+  for(int i = 0; i < NCPU; i++)
+    if(i != id && idle_kick(i))
+      return;
+}
+
+// Handle a timer interrupt. Called by devintr().
+void
+timerintr(void)
+{
+  struct cpu *c = mycpu();
+
+  cpustat[cpuid()].ntimerintr++;
+  clockintr();
+  // an idle hart's tick stays off; timer_busy() turns it
+  // back on when the hart leaves idle.
+  if(__atomic_load_n(&c->idle, __ATOMIC_RELAXED))
+    return;
+  timer_tick();
+  kickidle();
+}
+
+// Turn this hart's tick off, before the scheduler waits in wfi
+// for something to run. The timer then goes off only when the
+// next sleeper's timeout is due, or when another hart kicks
+// this one.
+// Called with interrupts off.
+void
+timer_idle(void)
+{
+  struct cpu *c = mycpu();
+  uint t = timeout_next();
+
+  timer_arm(t == ~0 ? -1 : (t + tickbase) * TICKCYCLES);
+  c->idlestart = r_time();
+  // a hart that queues a process and then finds idle clear
+  // leaves it to this one to see the process in timer_work().
+  __atomic_store_n(&c->idle, 1, __ATOMIC_SEQ_CST);
+  __sync_synchronize();
+  cpustat[cpuid()].nidle++;
+}
+
+// Whether any hart has processes waiting on its run queue,
+// for the scheduler to check once it is idle, before wfi.
+int
+timer_work(void)
+{
+  for(int i = 0; i < NCPU; i++)
+    if(runq_len(i))
+      return 1;
+  return 0;
+}
+
+// Turn this hart's tick back on when the scheduler leaves
+// wfi, and catch ticks up with the time it was idle.
+// woke is set if wfi was really entered.
+// Called with interrupts off.
+void
+timer_busy(int woke)
+{
+  struct cpu *c = mycpu();
+  struct cpustat *s = &cpustat[cpuid()];
+
+  __atomic_store_n(&c->idle, 0, __ATOMIC_SEQ_CST);
+  s->idletime += r_time() - c->idlestart;
+  if(woke)
+    s->nidlewake++;
+  timer_tick();
+  clockintr();
+}
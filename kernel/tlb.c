@@ -0,0 +1,179 @@
+// TLB shootdown.
+//
+// When a user mapping is removed or loses a permission, the
+// TLBs of the harts that have run the process under its
+// current ASIDs, p->cpumask, may still hold it. Callers gather
+// the pages they change in a struct tlbbatch: tlb_begin(),
+// then tlb_add() for each page, then tlb_flush() once for all:
+//
+//  - a few pages: tlb_flush() flushes them by address and ASID
+//    here and, through IPIs, on the other harts in p->cpumask.
+//  - more than TLB_MAXPAGES pages, or a caller that holds a
+//    spinlock, and p is the current process: it gives p new
+//    ASIDs (asid_invalidate()) instead, which makes every
+//    entry p had on any hart useless, without IPIs.
+//
+// An IPI writes the target's CLINT msip register, which raises
+// a machine-mode software interrupt there; timervec turns it
+// into a supervisor software interrupt, and devintr() calls
+// tlb_service(). Each hart has one mailbox, cpu->tlbreq, which
+// one initiator at a time claims. The initiator waits, with
+// interrupts off so that it stays on its hart, until each
+// target has flushed, serving its own mailbox meanwhile, so
+// that two harts shooting at each other cannot deadlock. A
+// target spinning for a lock that the initiator holds could,
+// so IPIs are only sent by callers that hold no spinlocks.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "cpustat.h"
+#include "defs.h"
+
+#define TLB_MAXPAGES 16
+
+extern struct cpu cpus[NCPU];
+extern struct cpustat cpustat[NCPU];
+
+// Start gathering pages whose mappings in p's user page table
+// change. p may be 0, for a page table no process is using.
+// For a process other than the caller, hold p->lock.
+void
+tlb_begin(struct tlbbatch *b, struct proc *p)
+{
+  b->p = p;
+  b->start = b->end = 0;
+  if(p){
+    b->asid = p->asid;
+    b->gen = p->asidgen;
+    b->cpumask = __atomic_load_n(&p->cpumask, __ATOMIC_RELAXED);
+  }
+}
+
+// Add the page at va to the batch.
+void
+tlb_add(struct tlbbatch *b, uint64 va)
+{
+  if(b->start == b->end){
+    b->start = va;
+    b->end = va + PGSIZE;
+  } else if(va < b->start){
+    b->start = va;
+  } else if(va + PGSIZE > b->end){
+    b->end = va + PGSIZE;
+  }
+}
+
+// Flush the pages in [start, end) of ASIDs asid and asid+1
+// from this hart's TLB.
+static void
+flushrange(uint asid, uint64 start, uint64 end)
+{
+  for(uint64 va = start; va < end; va += PGSIZE){
+    if(asid_none()){
+      sfence_vma_va(va);
+    } else {
+      sfence_vma_asid(va, asid);
+      sfence_vma_asid(va, asid + 1);
+    }
+  }
+  cpustat[cpuid()].npageflush += (end - start) / PGSIZE;
+}
+
+// Do the flush another hart asked this one for, if any.
+// Called with interrupts off, by devintr() and by initiators
+// waiting in tlb_flush().
+void
+tlb_service(void)
+{
+  struct tlbreq *r = &mycpu()->tlbreq;
+
+  if(!__atomic_load_n(&r->ready, __ATOMIC_ACQUIRE))
+    return;
+  flushrange(r->asid, r->start, r->end);
+  cpustat[cpuid()].nipirecv++;
+  __atomic_store_n(&r->ready, 0, __ATOMIC_RELEASE);
+}
+
+// Ask hart id to flush b's pages.
+static void
+tlb_send(int id, struct tlbbatch *b)
+{
+  struct tlbreq *r = &cpus[id].tlbreq;
+
+  while(__sync_lock_test_and_set(&r->busy, 1))
+    tlb_service();
+  r->asid = b->asid;
+  r->start = b->start;
+  r->end = b->end;
+  // the page-table changes, and the request, must be visible
+  // before the target looks.
+  __atomic_store_n(&r->ready, 1, __ATOMIC_RELEASE);
+  *(volatile uint32*)CLINTVA_MSIP(id) = 1;
+}
+
+// Wait for hart id to do the flush tlb_send() asked for.
+static void
+tlb_wait(int id)
+{
+  struct tlbreq *r = &cpus[id].tlbreq;
+
+  while(__atomic_load_n(&r->ready, __ATOMIC_ACQUIRE))
+    tlb_service();
+  __sync_lock_release(&r->busy);
+}
+
+// Make sure that no hart's TLB still holds the old mappings
+// of the pages in b.
+void
+tlb_flush(struct tlbbatch *b)
+{
+  struct proc *p = b->p;
+  uint64 mask, t0;
+  int me, id, dead;
+
+  if(p == 0 || b->start == b->end)
+    return;
+  // p's ASIDs are of an earlier generation: once p stops
+  // running, it never uses them again.
+  dead = !asid_none() && b->gen != asid_gen();
+
+  if(p == myproc() &&
+     (dead || b->end - b->start > TLB_MAXPAGES*PGSIZE || !intr_get())){
+    asid_invalidate(p);
+    push_off();
+    cpustat[cpuid()].nasidflush++;
+    pop_off();
+    return;
+  }
+  if(dead)
+    return;
+  if(!intr_get())
+    panic("tlb_flush: holding locks");
+
+  push_off();
+  me = cpuid();
+  mask = b->cpumask & ~(1L << me);
+  if(mask){
+    t0 = r_time();
+    for(id = 0; id < NCPU; id++){
+      if(mask & (1L << id)){
+        tlb_send(id, b);
+        cpustat[me].nipisent++;
+      }
+    }
+    if(b->cpumask & (1L << me))
+      flushrange(b->asid, b->start, b->end);
+    for(id = 0; id < NCPU; id++)
+      if(mask & (1L << id))
+        tlb_wait(id);
+    cpustat[me].nshootdown++;
+    cpustat[me].waittime += r_time() - t0;
+  } else if(b->cpumask & (1L << me)){
+    flushrange(b->asid, b->start, b->end);
+  }
+  pop_off();
+}
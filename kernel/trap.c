@@ -10,6 +10,7 @@ struct spinlock tickslock;
 uint ticks;
 
 extern char trampoline[], uservec[], userret[];
+extern char uaccess_start[], uaccess_end[], uaccess_fault[];
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
@@ -20,6 +21,7 @@ void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+  ticksinit();
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -65,6 +67,19 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // page fault on a demand-filled, copy-on-write or swapped-out
+    // page. filling it may wait for the disk, so take interrupts
+    // once the trap registers have been read.
+    uint64 scause = r_scause(), stval = r_stval();
+    intr_on();
+    int access = scause == 15 ? FAULT_WRITE :
+                 scause == 12 ? FAULT_EXEC : FAULT_READ;
+    if(uvmfault(p, stval, access) < 0){
+      printf("usertrap(): unexpected scause %p pid=%d\n", scause, p->pid);
+      printf("            sepc=%p stval=%p\n", p->trapframe->epc, stval);
+      setkilled(p);
+    }
   // 判断是否是设备中断
   } else if((which_dev = devintr()) != 0){
     // ok
@@ -79,7 +94,7 @@ usertrap(void)
 
   // give up the CPU if this is a timer interrupt.
   // 如果是一次时钟中断，主动放弃cpu
-  if(which_dev == 2)
+  if(which_dev == 2 && runq_tick(p))
     yield();
 
   usertrapret();
@@ -109,7 +124,9 @@ usertrapret(void)
   // the process next traps into the kernel.
   // 设置trapframe中当进程再次进入内核时所需要的数据
   // 这也就是之前在trampoline中加载的，那些进程中的内核相关数据的来源
-  p->trapframe->kernel_satp = r_satp();         // kernel page table
+  // p's ASIDs may have been taken away since it was scheduled.
+  asid_activate(p);
+  p->trapframe->kernel_satp = MAKE_SATP_ASID(p->kpagetable, p->asid); // kernel page table
   p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
   p->trapframe->kernel_trap = (uint64)usertrap;
   p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
@@ -131,7 +148,9 @@ usertrapret(void)
 
   // tell trampoline.S the user page table to switch to.
   // satp变量即用户进程页表
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // without ASIDs, an ASID field of 0 tells trampoline.S to
+  // flush the TLB.
+  uint64 satp = MAKE_SATP_ASID(p->pagetable, asid_none() ? 0 : p->asid + 1);
 
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
@@ -157,14 +176,24 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  // nothing here touches user memory, even if the trap came
+  // from uaccess.S; w_sstatus() below puts SUM back.
+  w_sstatus(sstatus & ~SSTATUS_SUM);
+
+  if((scause == 13 || scause == 15) &&
+     sepc >= (uint64)uaccess_start && sepc < (uint64)uaccess_end){
+    // page fault on a user address in uaccess.S:
+    // make it return -1, to take the slow path.
+    sepc = (uint64)uaccess_fault;
+  } else if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
   }
 
   // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING &&
+     runq_tick(myproc()))
     yield();
 
   // the yield() may have caused some traps to occur,
@@ -173,13 +202,30 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+// Bring ticks up to date with the time, and run the timeouts
+// that are due (timeout.c).
+// Called on a timer interrupt on any hart, and by a hart that
+// leaves idle, so ticks keeps counting while some harts, even
+// hart 0, take no timer interrupts; see timer.c.
 void
 clockintr()
 {
+  uint t, old;
+
+  t = timer_ticks();
+  if(t == __atomic_load_n(&ticks, __ATOMIC_RELAXED))
+    return;
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  old = ticks;
+  if(t <= old){
+    // another hart got here first.
+    release(&tickslock);
+    return;
+  }
+  ticks = t;
+  timeout_run(t);
   release(&tickslock);
+  runq_clock(old, t);
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -215,17 +261,23 @@ devintr()
 
     return 1;
   } else if(scause == 0x8000000000000001L){
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // software interrupt from a machine-mode timer interrupt
+    // or IPI, forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
+    // the SSIP bit in sip, first, so that one that arrives
+    // meanwhile is not lost.
     w_sip(r_sip() & ~2);
 
+    // an IPI asking for a TLB shootdown?
+    tlb_service();
+    // an IPI from idle_kick() needs nothing more: scheduler()
+    // is out of wfi, and will find the process queued for it.
+
+    if(!timertick())
+      return 1;
+    timerintr();
+
     return 2;
   } else {
     return 0;
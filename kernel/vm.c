@@ -7,16 +7,36 @@
 #include "fs.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sysinfo.h"
 
 /*
  * the kernel's page table.
  */
 pagetable_t kernel_pagetable;
 
+// a page of zeros, mapped read-only and copy-on-write for
+// reads of heap pages that have never been written.
+static char *zeropage;
+
+// User memory in 2 MiB megapages ("huge pages"): a heap or
+// exec region that covers a whole aligned 2 MiB, of which
+// nothing is mapped yet, gets a single level-1 leaf PTE and a
+// 2 MiB block from kalloc_order(), if there is one free. Fork
+// shares the block copy-on-write, with one reference per
+// sharer. A megapage that is partly freed, or that a write
+// must copy when there is no 2 MiB block for the copy, is
+// split into 512 ordinary pages first: an unshared block is
+// split in place (ksplit()), a shared one copied. Swapping
+// leaves megapages alone.
+#define MEGAORDER (PXSHIFT(1) - PGSHIFT)
+static uint64 nhuge;   // 2 MiB blocks in use as megapages
+
 extern char etext[];  // kernel.ld sets this to end of kernel code. kernel.ld 会设置这个在内核代码结束那里.
 
 extern char trampoline[]; // trampoline.S
 
+static void kvmmirror(struct proc*, uint64, uint64);
+
 // Make a direct-map page table for the kernel.
 // 为内核创建一个直接映射页表
 pagetable_t
@@ -24,8 +44,7 @@ kvmmake(void)
 {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t) kalloc_zeroed(KM_PAGETABLE);
 
   // uart registers
   // uart 寄存器
@@ -65,6 +84,8 @@ kvminit(void)
 {
   //  kernel_pagetable = kvmmake();
    kernel_pagetable = vmmake();
+   if((zeropage = kalloc_zeroed(KM_USER)) == 0)
+     panic("kvminit: zeropage");
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -83,6 +104,17 @@ kvminithart()
   sfence_vma();
 }
 
+// Switch back to kernel_pagetable from a process's kernel
+// page table. kernel_pagetable has ASID 0, which no process
+// uses, so its TLB entries are still good.
+void
+kvmswitch(void)
+{
+  w_satp(MAKE_SATP(kernel_pagetable));
+  if(asid_none())
+    sfence_vma();
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -108,32 +140,58 @@ kvminithart()
 //    0..11 -- 12位的页中字节偏移量
 
 // walk会返回虚拟地址对应的最后一级页表项，若alloc!=0，并且va没有对应的页表项，则会为它创建出一个页表项。
+//
+// If va is mapped by a megapage or gigapage, walk returns
+// that leaf PTE instead; see walk_level().
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  int level = 0;
+
+  return walk_level(pagetable, va, &level, alloc);
+}
+
+// Like walk(), but return the PTE at level *level (0, 1 or 2),
+// or the leaf PTE found above that level, which is then
+// stored in *level.
+pte_t *
+walk_level(pagetable_t pagetable, uint64 va, int *level, int alloc)
 {
   if(va >= MAXVA)
     panic("walk");
 
   // 从2级开始
-  for(int level = 2; level > 0; level--) {
+  for(int l = 2; l > *level; l--) {
     // 获取每个级别的页表索引
-    pte_t *pte = &pagetable[PX(level, va)];
+    pte_t *pte = &pagetable[PX(l, va)];
     // 如果存在pte并且有效，合法，从PTE中取出下一级页表物理地址并替换pagetable
     if(*pte & PTE_V) {
+      // a megapage or gigapage leaf
+      if(PTE_LEAF(*pte)){
+        *level = l;
+        return pte;
+      }
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
       // 走到这里，说明不存在pte，或者该pte已经是无效pte
       // 如果不允许分配，或者尝试为该pte分配新的下一级页表失败，直接返回0
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      // 新页表取自预先清零的页面池
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed(KM_PAGETABLE)) == 0)
         return 0;
-      // 将刚刚创建的新页表填充0
-      memset(pagetable, 0, PGSIZE);
       // 设置正确的pte
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
    // 返回最后一级页表中的PTE
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(*level, va)];
+}
+
+// The physical address of the page at va, which a leaf PTE
+// pte at the given level maps.
+static uint64
+leafpa(pte_t pte, int level, uint64 va)
+{
+  return PTE2PA(pte) + (PGROUNDDOWN(va) & (LEVELSIZE(level) - 1));
 }
 
 // Look up a virtual address, return the physical address,
@@ -146,20 +204,19 @@ uint64
 walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
-  uint64 pa;
+  int level = 0;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walk_level(pagetable, va, &level, 0);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
-  return pa;
+  return leafpa(*pte, level, va);
 }
 
 // add a mapping to the kernel page table.
@@ -171,10 +228,44 @@ walkaddr(pagetable_t pagetable, uint64 va)
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
+  if(kmappages(kpgtbl, va, sz, pa, perm) != 0)
     panic("kvmmap");
 }
 
+// Like mappages(), but use 2 MiB and 1 GiB leaf PTEs wherever
+// va, pa and the remaining size allow, so that large kernel
+// mappings take few page-table pages and TLB entries.
+// Returns 0 on success, -1 if walk_level() couldn't allocate
+// a needed page-table page.
+int
+kmappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
+{
+  uint64 a, end;
+  pte_t *pte;
+  int level, l;
+
+  if(size == 0)
+    panic("kmappages: size");
+
+  a = PGROUNDDOWN(va);
+  end = PGROUNDDOWN(va + size - 1) + PGSIZE;
+  while(a < end){
+    for(level = 2; level > 0; level--)
+      if(a % LEVELSIZE(level) == 0 && pa % LEVELSIZE(level) == 0 &&
+         end - a >= LEVELSIZE(level))
+        break;
+    l = level;
+    if((pte = walk_level(pagetable, a, &l, 1)) == 0)
+      return -1;
+    if(*pte & PTE_V)
+      panic("kmappages: remap");
+    *pte = PA2PTE(pa) | perm | PTE_V;
+    a += LEVELSIZE(level);
+    pa += LEVELSIZE(level);
+  }
+  return 0;
+}
+
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
 // be page-aligned. Returns 0 on success, -1 if walk() couldn't
@@ -216,23 +307,154 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
+// The process whose TLB entries changes to pagetable must be
+// flushed from: the current one, if pagetable is its. Other
+// page tables are not in use, or are flushed by their owner.
+static struct proc *
+uvmproc(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  if(p && p->pagetable == pagetable)
+    return p;
+  return 0;
+}
+
+// Map a fresh zeroed megapage at va, which must be 2 MiB-
+// aligned, if nothing in its 2 MiB is mapped yet and a 2 MiB
+// block is free. Returns 0, or -1 if the caller should map
+// ordinary pages instead.
+static int
+uvmmaphuge(pagetable_t pagetable, uint64 va, int perm)
+{
+  int level = 1;
+  pte_t *pte;
+  char *mem;
+
+  if((pte = walk_level(pagetable, va, &level, 1)) == 0 || level != 1 || *pte != 0)
+    return -1;
+  if((mem = kalloc_order(MEGAORDER, KM_USER)) == 0)
+    return -1;
+  memset(mem, 0, LEVELSIZE(1));
+  *pte = PA2PTE(mem) | perm | PTE_V;
+  __atomic_add_fetch(&nhuge, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+// Megapages mapped in user page tables, for sysinfo_ext().
+uint64
+uvmhugepages(void)
+{
+  return __atomic_load_n(&nhuge, __ATOMIC_RELAXED);
+}
+
+// Drop a megapage's reference to its block.
+static void
+uvmfreehuge(uint64 pa)
+{
+  if(kfree_order((void*)pa, MEGAORDER))
+    __atomic_sub_fetch(&nhuge, 1, __ATOMIC_RELAXED);
+}
+
+// If va is in a megapage, map its 2 MiB with 512 ordinary
+// pages instead. A copy-on-write block that others share is
+// copied, into pages that are then writable.
+// Returns 0, or -1 if there is no memory.
+// Sleeps, so the caller must not hold a spinlock.
+static int
+uvmsplit(pagetable_t pagetable, uint64 va)
+{
+  uint64 base = va & ~(LEVELSIZE(1) - 1), pa;
+  pagetable_t pt;
+  struct tlbbatch b;
+  int level = 0, i;
+  uint flags;
+  pte_t *pte;
+  char *mem;
+
+  if((pte = walk_level(pagetable, va, &level, 0)) == 0 || level != 1)
+    return 0;
+  pa = PTE2PA(*pte);
+  flags = PTE_FLAGS(*pte);
+  if((pt = (pagetable_t)kalloc_zeroed(KM_PAGETABLE)) == 0)
+    return -1;
+  if(krefcount((void*)pa) == 1){
+    for(i = 0; i < 512; i++)
+      pt[i] = PA2PTE(pa + i*PGSIZE) | flags;
+    ksplit((void*)pa, MEGAORDER);
+    __atomic_sub_fetch(&nhuge, 1, __ATOMIC_RELAXED);
+  } else {
+    // the other sharers keep the block, and their references.
+    if(flags & PTE_COW)
+      flags = (flags & ~PTE_COW) | PTE_W;
+    for(i = 0; i < 512; i++){
+      if((mem = kalloc_user(0)) == 0){
+        while(--i >= 0)
+          kfree((void*)PTE2PA(pt[i]));
+        kfree(pt);
+        return -1;
+      }
+      memmove(mem, (char*)pa + i*PGSIZE, PGSIZE);
+      pt[i] = PA2PTE(mem) | flags;
+    }
+    // kalloc_user() may have slept; only we change our PTEs.
+    uvmfreehuge(pa);
+  }
+  *pte = PA2PTE(pt) | PTE_V;
+  tlb_begin(&b, uvmproc(pagetable));
+  tlb_add(&b, base);
+  tlb_add(&b, base + LEVELSIZE(1) - PGSIZE);
+  tlb_flush(&b);
+  return 0;
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
-// Optionally free the physical memory.
+// page-aligned. Pages that are not mapped are skipped.
+// Optionally free the physical memory, or the swap slot of
+// a swapped-out page.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, end = va + npages*PGSIZE;
   pte_t *pte;
+  struct tlbbatch b;
+  int level;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+  tlb_begin(&b, uvmproc(pagetable));
+  for(a = va; a < end; a += PGSIZE){
+    // skip holes left by lazy allocation, a whole 2 MiB
+    // region at a time if it has no page-table page.
+    level = 0;
+    if((pte = walk_level(pagetable, a, &level, 0)) == 0){
+      a = (a & ~(LEVELSIZE(1) - 1)) + LEVELSIZE(1) - PGSIZE;
+      continue;
+    }
+    if(level == 1){
+      if(a % LEVELSIZE(1) == 0 && a + LEVELSIZE(1) <= end){
+        if(do_free)
+          uvmfreehuge(PTE2PA(*pte));
+        *pte = 0;
+        tlb_add(&b, a);
+        tlb_add(&b, a + LEVELSIZE(1) - PGSIZE);
+        a += LEVELSIZE(1) - PGSIZE;
+        continue;
+      }
+      // only part of the megapage goes.
+      if(uvmsplit(pagetable, a) < 0)
+        panic("uvmunmap: split");
+      pte = walk(pagetable, a, 0);
+    }
+    if(*pte & PTE_SWAP){
+      if(do_free)
+        swapfree(PTE2SLOT(*pte));
+      *pte = 0;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -240,7 +462,9 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
       kfree((void*)pa);
     }
     *pte = 0;
+    tlb_add(&b, a);
   }
+  tlb_flush(&b);
 }
 
 // create an empty user page table.
@@ -249,10 +473,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed(KM_PAGETABLE);
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -266,8 +489,7 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed(KM_USER);
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -285,12 +507,16 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    if(a % LEVELSIZE(1) == 0 && a + LEVELSIZE(1) <= newsz &&
+       uvmmaphuge(pagetable, a, PTE_R|PTE_U|xperm) == 0){
+      a += LEVELSIZE(1) - PGSIZE;
+      continue;
+    }
+    mem = kalloc_user(1);
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -303,7 +529,8 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size, which is oldsz
+// if a megapage had to be split and there was no memory.
 uint64
 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
@@ -312,6 +539,11 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
+    // a megapage that stays in part is split here, where
+    // running out of memory can still be reported.
+    if(PGROUNDUP(newsz) % LEVELSIZE(1) != 0 &&
+       uvmsplit(pagetable, PGROUNDUP(newsz)) < 0)
+      return oldsz;
     uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
   }
 
@@ -348,42 +580,219 @@ uvmfree(pagetable_t pagetable, uint64 sz)
   freewalk(pagetable);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Given a parent process's page table, share
+// its memory with a child's page table.
+// Writable pages become read-only copy-on-write
+// pages in both; uvmcow() copies them on the
+// first write.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
+  return uvmcopyrange(old, new, 0, sz, 0);
+}
+
+// Like uvmcopy(), for the pages in [start, end); start must
+// be page-aligned. If shared is set, pages stay writable and
+// are shared for good, as for a MAP_SHARED mapping.
+// Swapped-out pages share the swap slot.
+int
+uvmcopyrange(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int shared)
+{
+  pte_t *pte, *npte;
   uint64 pa, i;
   uint flags;
-  char *mem;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+  struct tlbbatch b;
+  int level;
+
+  tlb_begin(&b, uvmproc(old));
+  for(i = start; i < end; i += PGSIZE){
+    // skip holes left by lazy allocation.
+    level = 0;
+    if((pte = walk_level(old, i, &level, 0)) == 0){
+      i = (i & ~(LEVELSIZE(1) - 1)) + LEVELSIZE(1) - PGSIZE;
+      continue;
+    }
+    if(level == 1){
+      // share the whole megapage.
+      if(i % LEVELSIZE(1) != 0 || i + LEVELSIZE(1) > end)
+        panic("uvmcopyrange: megapage");
+      if((*pte & PTE_W) && !shared){
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+        tlb_add(&b, i);
+        tlb_add(&b, i + LEVELSIZE(1) - PGSIZE);
+      }
+      if((npte = walk_level(new, i, &level, 1)) == 0 || level != 1)
+        goto err;
+      *npte = *pte;
+      kref((void*)PTE2PA(*pte));
+      i += LEVELSIZE(1) - PGSIZE;
+      continue;
+    }
+    if(*pte & PTE_SWAP){
+      if((npte = walk(new, i, 1)) == 0)
+        goto err;
+      *npte = *pte;
+      swapdup(PTE2SLOT(*pte));
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
+    if((*pte & PTE_W) && !shared){
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+      tlb_add(&b, i);
+    }
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    }
+    kref((void*)pa);
   }
+  tlb_flush(&b);
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  tlb_flush(&b);
+  uvmunmap(new, start, (i - start) / PGSIZE, 1);
   return -1;
 }
 
+// Handle a write to the copy-on-write page at va: give the
+// page table its own writable copy, or just make the page
+// writable if nothing else refers to it any more.
+// Returns 0 on success, -1 if va is not a copy-on-write
+// page or there is no memory for the copy.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+  struct tlbbatch b;
+  int level = 0;
+
+  if(va >= MAXVA)
+    return -1;
+  if((pte = walk_level(pagetable, va, &level, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_V | PTE_U | PTE_COW)) != (PTE_V | PTE_U | PTE_COW))
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  if(level == 1 && krefcount((void*)pa) != 1){
+    // copy the megapage, or if there is no 2 MiB block
+    // for the copy, split it into copied pages.
+    if((mem = kalloc_order(MEGAORDER, KM_USER)) == 0)
+      return uvmsplit(pagetable, va);
+    __atomic_add_fetch(&nhuge, 1, __ATOMIC_RELAXED);
+    memmove(mem, (char*)pa, LEVELSIZE(1));
+    *pte = PA2PTE(mem) | flags;
+    va &= ~(LEVELSIZE(1) - 1);
+    tlb_begin(&b, uvmproc(pagetable));
+    tlb_add(&b, va);
+    tlb_add(&b, va + LEVELSIZE(1) - PGSIZE);
+    tlb_flush(&b);
+    uvmfreehuge(pa);
+    return 0;
+  }
+  if(krefcount((void*)pa) == 1){
+    // only made writable: a stale read-only translation at
+    // most causes a spurious fault, see uvmfault().
+    *pte = PA2PTE(pa) | flags;
+    sfence_vma_va(va);
+    return 0;
+  }
+  // hold a reference of our own while kalloc_user() sleeps, so
+  // that swapout() leaves the page alone even if the other
+  // references go away meanwhile.
+  kref((void*)pa);
+  if((mem = kalloc_user(pa == (uint64)zeropage)) == 0){
+    kfree((void*)pa);
+    return -1;
+  }
+  if(pa != (uint64)zeropage)
+    memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  tlb_begin(&b, uvmproc(pagetable));
+  tlb_add(&b, va);
+  tlb_flush(&b);
+  kfree((void*)pa);   // the PTE's reference
+  kfree((void*)pa);   // ours
+  return 0;
+}
+
+// Handle a page fault at va in process p. Swapped-out pages
+// are read back by swapin(). Pages of a memory
+// area in p->vma are filled by vma_fault(). Heap pages are
+// allocated on first touch: a write maps a fresh zeroed page,
+// a read maps the shared zero page read-only and copy-on-write.
+// A write to a copy-on-write page copies it. A heap fault in
+// a 2 MiB region that is free and wholly below p->sz maps a
+// megapage over the whole region instead.
+// access is FAULT_READ, FAULT_WRITE or FAULT_EXEC.
+// Returns 0 if the fault was handled, -1 if the access is not
+// allowed or there is no memory.
+int
+uvmfault(struct proc *p, uint64 va, int access)
+{
+  pagetable_t pagetable = p->pagetable;
+  struct vma *v;
+  pte_t *pte;
+  char *mem;
+  uint64 base;
+
+  if(va >= MAXUVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_SWAP)){
+    if(swapin(pte) < 0)
+      return -1;
+    // a write fault retries and copies the page if it is COW.
+    return 0;
+  }
+  if(pte && (*pte & PTE_V)){
+    if(access == FAULT_WRITE && (*pte & PTE_COW))
+      return uvmcow(pagetable, va);
+    // the page allows the access: the TLB held a translation
+    // from before the page was mapped or upgraded, which the
+    // ASID scheme does not flush. drop it and retry.
+    if((*pte & PTE_U) &&
+       (*pte & (access == FAULT_WRITE ? PTE_W :
+                access == FAULT_EXEC ? PTE_X : PTE_R))){
+      sfence_vma_va(va);
+      return 0;
+    }
+    return -1;
+  }
+
+  if((v = vma_find(p->vma, va)) != 0)
+    return vma_fault(pagetable, v, va, access == FAULT_WRITE);
+  if(va >= p->sz)
+    return -1;
+
+  base = va & ~(LEVELSIZE(1) - 1);
+  if(base + LEVELSIZE(1) <= p->sz && !vma_overlap(p->vma, base, base + LEVELSIZE(1)) &&
+     uvmmaphuge(pagetable, base, PTE_R|PTE_W|PTE_U) == 0)
+    return 0;
+
+  if(access == FAULT_WRITE){
+    if((mem = kalloc_user(1)) == 0)
+      return -1;
+    if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+      kfree(mem);
+      return -1;
+    }
+  } else {
+    if(mappages(pagetable, va, PGSIZE, (uint64)zeropage, PTE_R|PTE_U|PTE_COW) != 0)
+      return -1;
+    kref(zeropage);
+  }
+  return 0;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -397,6 +806,54 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Return the physical address of the user page at va for an
+// access by the kernel, first faulting the page in if it
+// belongs to the current process and is not mapped yet, and
+// copying it if it is copy-on-write and the access is a write.
+// Returns 0 if the page is not accessible.
+static uint64
+uvmaddr(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  int level = 0;
+
+  if(va >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0){
+    if(p == 0 || pagetable != p->pagetable ||
+       uvmfault(p, va, write ? FAULT_WRITE : FAULT_READ) < 0)
+      return 0;
+    pte = walk(pagetable, va, 0);
+  }
+  if((*pte & PTE_U) == 0)
+    return 0;
+  if(write && (*pte & PTE_W) == 0 && uvmcow(pagetable, va) < 0)
+    return 0;
+  // uvmcow() may have replaced or split a megapage.
+  pte = walk_level(pagetable, va, &level, 0);
+  // the hardware sets these only for accesses through the
+  // page table; vma_writeback() and swapout() go by them.
+  *pte |= write ? PTE_A | PTE_D : PTE_A;
+  return leafpa(*pte, level, va);
+}
+
+// Fault in the current process's pages in [va, va+n) ahead
+// of a copy that will be made while holding a sleep-lock, so
+// that the copy does not have to fill pages from a file.
+// Best effort: stops at the first page that cannot be had.
+void
+uvmprefault(uint64 va, uint64 n, int write)
+{
+  struct proc *p = myproc();
+  uint64 a;
+
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE)
+    if(uvmaddr(p->pagetable, a, write) == 0)
+      break;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -407,8 +864,7 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = uvmaddr(pagetable, va0, 1)) == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
     if(n > len)
@@ -432,8 +888,7 @@ copyin_new(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = uvmaddr(pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
@@ -446,10 +901,41 @@ copyin_new(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
   }
   return 0;
 }
+// Whether the current process can load from [va, va+len) in
+// pagetable directly, with uaccess.S, after mirroring it.
+// A direct load does not check PTE_U, so a range that touches
+// a mapped page without it, like the stack guard page, is left
+// to copyin_new(), which refuses it as uvmaddr() does. Pages
+// that are not mapped yet fault, and go the same way.
+static int
+uaccessok(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  uint64 a;
+  pte_t *pte;
+  int level;
+
+  if(p == 0 || pagetable != p->pagetable || p->kpagetable == 0 ||
+     len == 0 || va >= MAXUVA || len > MAXUVA - va)
+    return 0;
+  for(a = PGROUNDDOWN(va); a < va + len; a = (a | (LEVELSIZE(level) - 1)) + 1){
+    level = 0;
+    pte = walk_level(pagetable, a, &level, 0);
+    if(pte && (*pte & PTE_V) && (*pte & PTE_U) == 0)
+      return 0;
+  }
+  kvmmirror(p, va, len);
+  return 1;
+}
+
  // my code
+ // 先直接从用户地址读，缺页时再走copyin_new
  int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
+  if(uaccessok(pagetable, srcva, len) &&
+     uaccess_copy(dst, (char*)srcva, len) == 0)
+    return 0;
   return copyin_new(pagetable, dst, srcva, len);
 }
 
@@ -465,8 +951,7 @@ copyinstr_new(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = uvmaddr(pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > max)
@@ -497,9 +982,23 @@ copyinstr_new(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 }
 
 // my code
+// 先用uaccess_strnlen找到字符串末尾，再整段复制
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
+  int n;
+
+  if(max > 0 && srcva < MAXUVA && max > MAXUVA - srcva)
+    max = MAXUVA - srcva;
+  if(uaccessok(pagetable, srcva, max) &&
+     (n = uaccess_strnlen((char*)srcva, max)) >= 0){
+    if(n == max)
+      return -1;
+    if(uaccess_copy(dst, (char*)srcva, n) == 0){
+      dst[n] = '\0';
+      return 0;
+    }
+  }
   return copyinstr_new(pagetable, dst, srcva, max);
 }
 
@@ -517,7 +1016,7 @@ vmprint(pagetable_t pagetable, uint depth)
         printf(".. ");
       uint64 child = PTE2PA(pte);
       printf("..%d: pte %p pa %p\n", i, pte, child);
-      if(depth < 2)
+      if(depth < 2 && !PTE_LEAF(pte))
         // 如果层数等于 2 就不需要继续递归了，因为这是叶子节点
         vmprint((pagetable_t) child, depth + 1);
     }
@@ -531,41 +1030,181 @@ vmprint(pagetable_t pagetable, uint depth)
 void 
 kvmmap2(pagetable_t pt, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-    if(mappages(pt, va, sz, pa, perm) != 0)
+    if(kmappages(pt, va, sz, pa, perm) != 0)
         panic("kvmmap2");
 }
 
+// Build kernel_pagetable. Mappings that every process's kernel
+// page table shares are global (PTE_G), so their TLB entries
+// serve all ASIDs. Nothing is mapped below MAXUVA, where each
+// process's kernel page table mirrors its user pages: not even
+// CLINT, which is mapped at CLINTVA instead.
 pagetable_t
 vmmake(void)
 {
-  pagetable_t pt = (pagetable_t) kalloc();
-  memset(pt, 0, PGSIZE);
+  pagetable_t pt = (pagetable_t) kalloc_zeroed(KM_PAGETABLE);
 
   // uart registers
-  kvmmap2(pt, UART0, UART0, PGSIZE, PTE_R | PTE_W);
+  kvmmap2(pt, UART0, UART0, PGSIZE, PTE_R | PTE_W | PTE_G);
 
   // virtio mmio disk interface
-  kvmmap2(pt, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
-
-  // CLINT
-  kvmmap2(pt, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+  kvmmap2(pt, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W | PTE_G);
 
   // PLIC
-  kvmmap2(pt, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
+  kvmmap2(pt, PLIC, PLIC, 0x400000, PTE_R | PTE_W | PTE_G);
+
+  // CLINT's msip registers, to send IPIs (tlb.c), and
+  // mtimecmp registers, to program timer interrupts (timer.c)
+  kvmmap2(pt, CLINTVA, CLINT, PGSIZE, PTE_R | PTE_W | PTE_G);
+  kvmmap2(pt, CLINTVA + PGSIZE, CLINT + 0x4000, PGSIZE, PTE_R | PTE_W | PTE_G);
 
   // map kernel text executable and read-only.
-  kvmmap2(pt, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
+  kvmmap2(pt, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X | PTE_G);
 
   // map kernel data and the physical RAM we'll make use of.
-  kvmmap2(pt, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
+  // kmappages() maps the 2 MiB-aligned part with megapages.
+  kvmmap2(pt, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W | PTE_G);
 
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
-  kvmmap2(pt, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
+  kvmmap2(pt, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X | PTE_G);
 
   return pt;
 }
 
+// Per-process kernel page tables share everything they can
+// with kernel_pagetable: kvmcreate() copies its root, so all
+// subtrees start out shared by pointer, and kvmprivate() gives
+// a process its own copies of just the page-table pages on the
+// path to an address it needs to map privately, such as its
+// kernel stack. A page-table page is private iff its PTE
+// differs from the one at the same place in kernel_pagetable.
+
+// Make the page-table pages on the path to va in pt, down to
+// the one holding va's level-`level` PTE, private to pt.
+// Returns 0 on success, -1 if out of memory.
+int
+kvmprivate(pagetable_t pt, uint64 va, int level)
+{
+  pagetable_t tmpl = kernel_pagetable;
+  pagetable_t n;
+
+  for(int l = 2; l > level; l--){
+    pte_t *pte = &pt[PX(l, va)];
+    pte_t t = tmpl ? tmpl[PX(l, va)] : 0;
+
+    if((*pte & PTE_V) && PTE_LEAF(*pte))
+      panic("kvmprivate: leaf");
+    if((*pte & PTE_V) == 0 || *pte == t){
+      if((n = (pagetable_t)kalloc_zeroed(KM_PAGETABLE)) == 0)
+        return -1;
+      if(*pte & PTE_V)
+        memmove(n, (void*)PTE2PA(*pte), PGSIZE);
+      *pte = PA2PTE(n) | PTE_V;
+    }
+    pt = (pagetable_t)PTE2PA(*pte);
+    tmpl = ((t & PTE_V) && !PTE_LEAF(t)) ? (pagetable_t)PTE2PA(t) : 0;
+  }
+  return 0;
+}
+
+// Create a kernel page table for a process, sharing all of
+// kernel_pagetable, with private page-table pages for the
+// kernel stack at TRAMPOLINE-2*PGSIZE, and for the first
+// 1 GiB, where kvmmirror() maps the process's user pages.
+// Returns 0 if out of memory.
+pagetable_t
+kvmcreate(void)
+{
+  pagetable_t pt;
+
+  if((pt = (pagetable_t)kalloc(KM_PAGETABLE)) == 0)
+    return 0;
+  memmove(pt, kernel_pagetable, PGSIZE);
+  if(kvmprivate(pt, TRAMPOLINE - 2*PGSIZE, 0) < 0 ||
+     kvmprivate(pt, 0, 1) < 0){
+    kvmfree(pt);
+    return 0;
+  }
+  return pt;
+}
+
+static void
+kvmfreewalk(pagetable_t pt, pagetable_t tmpl)
+{
+  for(int i = 0; i < 512; i++){
+    pte_t pte = pt[i];
+    pte_t t = tmpl ? tmpl[i] : 0;
+    if((pte & PTE_V) && !PTE_LEAF(pte) && pte != t)
+      kvmfreewalk((pagetable_t)PTE2PA(pte),
+                  ((t & PTE_V) && !PTE_LEAF(t)) ? (pagetable_t)PTE2PA(t) : 0);
+  }
+  kfree((void*)pt);
+}
+
+// Free a page table made by kvmcreate(): its private
+// page-table pages, but not the subtrees it shares with
+// kernel_pagetable or with the user page table, nor any
+// memory it maps.
+void
+kvmfree(pagetable_t pt)
+{
+  kvmunmirror(pt);
+  kvmfreewalk(pt, kernel_pagetable);
+}
+
+// The user part of the address space, below MAXUVA, is the
+// first NMIRROR level-1 PTEs of the first 1 GiB. A process's
+// kernel page table copies these PTEs from its user page
+// table, so that both share the level-0 page-table pages, and
+// the kernel can load from user addresses directly, with
+// sstatus.SUM set (uaccess.S). Only the level-1 PTEs have to
+// be kept up to date: kvmmirror() does that before each
+// direct access, for the addresses it will touch.
+#define NMIRROR (MAXUVA / LEVELSIZE(1))
+
+static pagetable_t
+kvmmirrorpt(pagetable_t pt)
+{
+  if((pt[0] & PTE_V) == 0)
+    return 0;
+  return (pagetable_t)PTE2PA(pt[0]);
+}
+
+// Mirror p's user mappings in [va, va+len) into its kernel
+// page table. va+len must be at most MAXUVA.
+static void
+kvmmirror(struct proc *p, uint64 va, uint64 len)
+{
+  pagetable_t k = kvmmirrorpt(p->kpagetable);
+  pagetable_t u = kvmmirrorpt(p->pagetable);
+  int stale = 0;
+
+  for(uint64 i = PX(1, va); i <= PX(1, va + len - 1); i++){
+    pte_t pte = u ? u[i] : 0;
+    if(k[i] != pte){
+      // a level-0 page replaced: the TLB may hold entries
+      // from the old one.
+      if(k[i] & PTE_V)
+        stale = 1;
+      k[i] = pte;
+    }
+  }
+  if(stale)
+    asid_invalidate(p);
+}
+
+// Forget the user mappings mirrored in a kernel page table,
+// before the user page table is freed.
+void
+kvmunmirror(pagetable_t pt)
+{
+  pagetable_t k = kvmmirrorpt(pt);
+
+  if(k && k != kvmmirrorpt(kernel_pagetable))
+    memset(k, 0, NMIRROR * sizeof(pte_t));
+}
+
 // uint64
 // kvmpa(uint64 va)
 // {
@@ -583,22 +1222,27 @@ vmmake(void)
 // }
 
 // 仿照uvmunmap写一个kvmunmap,唯一的区别是不用回收物理内存
+// Megapage and gigapage leaves are removed whole.
 void 
 kvmunmap(pagetable_t pagetable, uint64 va, uint64 size)
 {
     uint64 a;
     pte_t *pte;
+    int level;
 
     if((va % PGSIZE) != 0)
         panic("kvmunmap: not aligned");
 
-    for(a = va; a < va + size; a += PGSIZE){
-        if((pte = walk(pagetable, a, 0)) == 0)
+    for(a = va; a < va + size; a += LEVELSIZE(level)){
+        level = 0;
+        if((pte = walk_level(pagetable, a, &level, 0)) == 0)
             panic("kvmunmap: walk");
         if((*pte & PTE_V) == 0)
             panic("kvmunmap: not mapped");
         if(PTE_FLAGS(*pte) == PTE_V)
             panic("kvmunmap: not a leaf");
+        if(a % LEVELSIZE(level) != 0)
+            panic("kvmunmap: partial superpage");
 
         // 不需要销毁物理内存
         //uint64 pa = PTE2PA(*pte);
@@ -607,4 +1251,3 @@ kvmunmap(pagetable_t pagetable, uint64 va, uint64 size)
         *pte = 0;
     }
 }
-
@@ -0,0 +1,313 @@
+// Virtual memory areas.
+//
+// A process's vma[] records ranges of its address space whose
+// pages are filled when first touched, rather than up front:
+// exec() records the program's segments here instead of
+// reading them into memory, and mmap() adds file-backed and
+// anonymous mappings, placed top-down below MAXUVA. A page fault in an area calls
+// vma_fault(), which reads the page from the area's file into
+// a fresh page, zero-filling past the file-backed part. It
+// also fills the other unmapped pages of the area in the
+// aligned FAULTAROUND-page window around the fault, so that a
+// program running through its text takes one fault per window
+// rather than one per page.
+//
+// Pages of a MAP_SHARED file mapping are private to the
+// process (and its children, after fork) until munmap() or
+// exit() writes the dirty ones back to the file; other
+// processes mapping the same file do not see them before that.
+//
+// Filling a page locks the file's inode, so kernel code must
+// not fault on an area's page while holding a spinlock, or the
+// sleep-lock of an inode that may back one; fileread() and
+// filewrite() prefault user buffers before locking.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+
+#define FAULTAROUND 8
+
+// Return an area in vmas overlapping [start, end), or 0.
+struct vma*
+vma_overlap(struct vma *vmas, uint64 start, uint64 end)
+{
+  struct vma *v;
+
+  for(v = vmas; v < &vmas[NVMA]; v++)
+    if(v->end != 0 && start < v->end && v->start < end)
+      return v;
+  return 0;
+}
+
+// Record the area [start, end) in vmas, an array of NVMA.
+// flags is MAP_SHARED or MAP_PRIVATE. Takes a reference to
+// ip. Returns 0, or -1 if the range overlaps another area or
+// there is no free slot.
+int
+vma_add(struct vma *vmas, uint64 start, uint64 end, int perm, int flags,
+        struct inode *ip, uint64 off, uint64 filesz)
+{
+  struct vma *v;
+
+  if(start % PGSIZE != 0 || end % PGSIZE != 0 || start >= end)
+    return -1;
+  if(vma_overlap(vmas, start, end))
+    return -1;
+  for(v = vmas; v < &vmas[NVMA]; v++)
+    if(v->end == 0)
+      break;
+  if(v == &vmas[NVMA])
+    return -1;
+
+  v->start = start;
+  v->end = end;
+  v->perm = perm;
+  v->flags = flags;
+  v->ip = ip ? idup(ip) : 0;
+  v->off = off;
+  v->filesz = filesz;
+  return 0;
+}
+
+// Return the area containing va, or 0.
+struct vma*
+vma_find(struct vma *vmas, uint64 va)
+{
+  struct vma *v;
+
+  for(v = vmas; v < &vmas[NVMA]; v++)
+    if(v->end != 0 && v->start <= va && va < v->end)
+      return v;
+  return 0;
+}
+
+// Copy the areas of src to dst, for fork().
+void
+vma_dup(struct vma *dst, struct vma *src)
+{
+  for(int i = 0; i < NVMA; i++){
+    dst[i] = src[i];
+    if(dst[i].end != 0 && dst[i].ip)
+      idup(dst[i].ip);
+  }
+}
+
+// Forget all areas, dropping their file references. Their
+// pages, if mapped, stay mapped.
+void
+vma_free(struct vma *vmas)
+{
+  struct vma *v;
+
+  for(v = vmas; v < &vmas[NVMA]; v++){
+    if(v->end != 0 && v->ip){
+      begin_op();
+      iput(v->ip);
+      end_op();
+    }
+    v->end = 0;
+    v->ip = 0;
+  }
+}
+
+// Fill and map the page at va of area v.
+// Caller must hold v->ip's lock if v has a file.
+static int
+vma_fill(pagetable_t pagetable, struct vma *v, uint64 va)
+{
+  uint64 off = va - v->start;
+  char *mem;
+  uint n;
+
+  if((mem = kalloc_user(1)) == 0)
+    return -1;
+  if(v->ip && off < v->filesz){
+    n = v->filesz - off < PGSIZE ? v->filesz - off : PGSIZE;
+    if(readi(v->ip, 0, (uint64)mem, v->off + off, n) != n){
+      kfree(mem);
+      return -1;
+    }
+  }
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, v->perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Handle a fault at the unmapped address va of area v.
+// Returns 0 if the page is now mapped, -1 if the access is
+// not allowed or the page could not be filled.
+int
+vma_fault(pagetable_t pagetable, struct vma *v, uint64 va, int write)
+{
+  uint64 a, lo, hi;
+  pte_t *pte;
+  int r = 0;
+
+  if((v->perm & (PTE_R|PTE_W|PTE_X)) == 0)   // PROT_NONE
+    return -1;
+  if(write && (v->perm & PTE_W) == 0)
+    return -1;
+  va = PGROUNDDOWN(va);
+  lo = va & ~(FAULTAROUND*PGSIZE - 1);
+  hi = lo + FAULTAROUND*PGSIZE;
+  if(lo < v->start)
+    lo = v->start;
+  if(hi > v->end)
+    hi = v->end;
+
+  if(v->ip)
+    ilock(v->ip);
+  for(a = lo; a < hi; a += PGSIZE){
+    if((pte = walk(pagetable, a, 0)) != 0 && (*pte & (PTE_V|PTE_SWAP)))
+      continue;
+    // the neighbours are only an optimization.
+    if(vma_fill(pagetable, v, a) < 0 && a == va){
+      r = -1;
+      break;
+    }
+  }
+  if(v->ip)
+    iunlock(v->ip);
+  return r;
+}
+
+// Map len bytes of ip from offset off, or zeros if ip is 0,
+// into p's address space, at the highest free range below
+// MAXUVA that lies above the heap.
+// Returns the address, or -1.
+uint64
+vma_mmap(struct proc *p, uint64 len, int prot, int flags,
+         struct inode *ip, uint64 off)
+{
+  uint64 start, end, filesz = 0;
+  struct vma *v;
+  int perm = PTE_U;
+
+  if(prot & PROT_READ)
+    perm |= PTE_R;
+  if(prot & PROT_WRITE)
+    perm |= PTE_R | PTE_W;   // W without R is reserved
+  if(prot & PROT_EXEC)
+    perm |= PTE_X;
+
+  len = PGROUNDUP(len);
+  end = MAXUVA;
+  for(;;){
+    start = end - len;
+    if(start > end || start < PGROUNDUP(p->sz))
+      return -1;
+    if((v = vma_overlap(p->vma, start, end)) == 0)
+      break;
+    end = v->start;
+  }
+
+  if(ip){
+    ilock(ip);
+    if(ip->size > off)
+      filesz = ip->size - off < len ? ip->size - off : len;
+    iunlock(ip);
+  }
+  if(vma_add(p->vma, start, end, perm, flags & (MAP_SHARED|MAP_PRIVATE),
+             ip, off, filesz) < 0)
+    return -1;
+  return start;
+}
+
+// Write the dirty pages of shared area v in [start, end)
+// back to its file.
+static void
+vma_writeback(pagetable_t pagetable, struct vma *v, uint64 start, uint64 end)
+{
+  uint64 a, off;
+  pte_t *pte;
+  uint n;
+
+  for(a = start; a < end; a += PGSIZE){
+    off = a - v->start;
+    if(off >= v->filesz)
+      break;
+    pte = walk(pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_D) == 0)
+      continue;
+    n = v->filesz - off < PGSIZE ? v->filesz - off : PGSIZE;
+    // one page at a time, to stay within a log transaction.
+    begin_op();
+    ilock(v->ip);
+    writei(v->ip, 0, PTE2PA(*pte), v->off + off, n);
+    iunlock(v->ip);
+    end_op();
+  }
+}
+
+// Remove p's mappings in [start, end), which must be
+// page-aligned: write back the dirty pages of shared file
+// mappings, unmap and free the pages, and shrink, split or
+// drop the areas involved.
+// Returns 0, or -1 if an area cannot be split for lack of a
+// free slot.
+int
+vma_unmap(struct proc *p, uint64 start, uint64 end)
+{
+  struct vma *v, *w;
+  uint64 lo, hi;
+
+  if(start % PGSIZE != 0 || end % PGSIZE != 0 || start >= end)
+    return -1;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->end == 0 || end <= v->start || v->end <= start)
+      continue;
+    lo = start > v->start ? start : v->start;
+    hi = end < v->end ? end : v->end;
+
+    // a hole in the middle needs a second area for the top.
+    w = 0;
+    if(lo > v->start && hi < v->end){
+      for(w = p->vma; w < &p->vma[NVMA] && w->end != 0; w++)
+        ;
+      if(w == &p->vma[NVMA])
+        return -1;
+    }
+
+    if((v->flags & MAP_SHARED) && v->ip)
+      vma_writeback(p->pagetable, v, lo, hi);
+    uvmunmap(p->pagetable, lo, (hi - lo) / PGSIZE, 1);
+
+    if(w){
+      *w = *v;
+      w->start = hi;
+      w->off = v->off + (hi - v->start);
+      w->filesz = v->filesz > hi - v->start ? v->filesz - (hi - v->start) : 0;
+      if(w->ip)
+        idup(w->ip);
+      v->end = lo;
+      v->filesz = v->filesz < lo - v->start ? v->filesz : lo - v->start;
+    } else if(lo > v->start){
+      v->end = lo;
+      v->filesz = v->filesz < lo - v->start ? v->filesz : lo - v->start;
+    } else if(hi < v->end){
+      v->off += hi - v->start;
+      v->filesz = v->filesz > hi - v->start ? v->filesz - (hi - v->start) : 0;
+      v->start = hi;
+    } else {
+      if(v->ip){
+        begin_op();
+        iput(v->ip);
+        end_op();
+      }
+      v->end = 0;
+      v->ip = 0;
+    }
+  }
+  return 0;
+}
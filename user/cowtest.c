@@ -0,0 +1,150 @@
+// Tests for copy-on-write fork.
+// Forks a parent holding two thirds of free memory, writes to
+// copy-on-write pages from user code and from the kernel
+// (read() into a shared buffer), and reports how long fork
+// takes as the parent grows.
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+uint64
+freemem(void)
+{
+  struct sysinfo info;
+
+  if(sysinfo(&info) < 0){
+    printf("cowtest: sysinfo failed\n");
+    exit(1);
+  }
+  return info.freemem;
+}
+
+// fork three times while using two thirds of free memory,
+// which only works if fork does not copy it.
+void
+bigfork(void)
+{
+  uint64 sz = freemem() / 3 * 2;
+  char *p, *start;
+  int i, pid, xstatus, me = getpid();
+
+  printf("bigfork: ");
+  start = sbrk(sz);
+  if(start == (char*)-1){
+    printf("sbrk(%l) failed\n", sz);
+    exit(1);
+  }
+  for(p = start; p < start + sz; p += PGSIZE)
+    *(int*)p = me;
+
+  for(i = 0; i < 3; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      // read every page, and write every other one.
+      for(p = start; p < start + sz; p += PGSIZE){
+        if(*(int*)p != me)
+          exit(1);
+        if(((p - start) / PGSIZE) % 2 == 0)
+          *(int*)p = getpid();
+      }
+      exit(0);
+    }
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("child saw wrong data\n");
+      exit(1);
+    }
+  }
+  for(p = start; p < start + sz; p += PGSIZE){
+    if(*(int*)p != me){
+      printf("parent saw child's write\n");
+      exit(1);
+    }
+  }
+  sbrk(-sz);
+  printf("ok\n");
+}
+
+char buf[2*PGSIZE];
+
+// the kernel writes to copy-on-write pages in copyout().
+void
+copyouttest(void)
+{
+  int fds[2], pid, xstatus;
+  char *b = (char*)PGROUNDUP((uint64)buf);
+
+  printf("copyout: ");
+  b[0] = 'p';
+  if(pipe(fds) < 0){
+    printf("pipe failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[1]);
+    if(read(fds[0], b, 1) != 1 || b[0] != 'c')
+      exit(1);
+    exit(0);
+  }
+  close(fds[0]);
+  write(fds[1], "c", 1);
+  close(fds[1]);
+  wait(&xstatus);
+  if(xstatus != 0 || b[0] != 'p'){
+    printf("failed\n");
+    exit(1);
+  }
+  printf("ok\n");
+}
+
+// time 100 forks of a parent with a growing heap.
+void
+forklatency(void)
+{
+  int npages[] = { 1, 64, 1024, 4096 };
+  int i, j, t0;
+  char *start, *p;
+
+  for(i = 0; i < sizeof(npages)/sizeof(npages[0]); i++){
+    start = sbrk(npages[i] * PGSIZE);
+    if(start == (char*)-1)
+      break;
+    for(p = start; p < start + npages[i] * PGSIZE; p += PGSIZE)
+      *p = 1;
+    t0 = uptime();
+    for(j = 0; j < 100; j++){
+      int pid = fork();
+      if(pid < 0){
+        printf("fork failed\n");
+        exit(1);
+      }
+      if(pid == 0)
+        exit(0);
+      wait(0);
+    }
+    printf("fork latency: %d pages: 100 forks in %d ticks\n",
+           npages[i], uptime() - t0);
+    sbrk(-npages[i] * PGSIZE);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  bigfork();
+  copyouttest();
+  forklatency();
+  printf("ALL COW TESTS PASSED\n");
+  exit(0);
+}
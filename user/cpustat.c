@@ -0,0 +1,36 @@
+// Print each hart's TLB shootdown and scheduling counters,
+// then its timer and idle counters. Run it twice, some ticks
+// apart, to get rates such as idle wakeups per second.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/cpustat.h"
+#include "user/user.h"
+
+struct cpustat stats[NCPU];
+
+int
+main(int argc, char *argv[])
+{
+  int i, n;
+
+  if((n = cpustat(stats, NCPU)) < 0){
+    fprintf(2, "cpustat: cpustat failed\n");
+    exit(1);
+  }
+  printf("hart\tshootdowns\tipis sent\tipis done\tpages flushed\tasid flushes\twait cycles\tsteals\n");
+  for(i = 0; i < n; i++){
+    struct cpustat *s = &stats[i];
+    printf("%d\t%l\t%l\t%l\t%l\t%l\t%l\t%l\n", i, s->nshootdown, s->nipisent,
+           s->nipirecv, s->npageflush, s->nasidflush, s->waittime, s->nsteal);
+  }
+  printf("\nuptime %d ticks\n", uptime());
+  printf("hart\ttimer intrs\tidles\tidle wakes\tidle cycles\tkicks\twakeups\tavg wake latency\n");
+  for(i = 0; i < n; i++){
+    struct cpustat *s = &stats[i];
+    printf("%d\t%l\t%l\t%l\t%l\t%l\t%l\t%l\n", i, s->ntimerintr, s->nidle,
+           s->nidlewake, s->idletime, s->nkick, s->nwakeup,
+           s->nwakeup ? s->wakelat / s->nwakeup : 0);
+  }
+  exit(0);
+}
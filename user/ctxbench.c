@@ -0,0 +1,82 @@
+// Context-switch benchmark.
+// A parent and a child pass a byte back and forth over two
+// pipes, so that every round trip switches processes twice,
+// and each touches a working set of pages in between, whose
+// TLB entries survive the switches only if the kernel does not
+// flush the TLB. Reports elapsed ticks for each working set.
+// Run with one hart, make CPUS=1 qemu, so that the two
+// processes really take turns on it.
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define ROUNDS 2000
+#define MAXPAGES 64
+
+char pages[MAXPAGES][PGSIZE];
+
+void
+touch(int npages)
+{
+  for(int i = 0; i < npages; i++)
+    pages[i][0]++;
+}
+
+// pass a byte from in to out ROUNDS times, touching npages
+// pages each time.
+void
+pingpong(int in, int out, int npages, int first)
+{
+  char c = 0;
+
+  for(int r = 0; r < ROUNDS; r++){
+    if(!first || r > 0){
+      if(read(in, &c, 1) != 1){
+        printf("ctxbench: read failed\n");
+        exit(1);
+      }
+    }
+    touch(npages);
+    if(write(out, &c, 1) != 1){
+      printf("ctxbench: write failed\n");
+      exit(1);
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int p1[2], p2[2], npages, pid, t0, t1, xstatus;
+
+  printf("pages\tticks\tround trips\n");
+  for(npages = 0; npages <= MAXPAGES; npages = npages ? 2*npages : 1){
+    if(pipe(p1) < 0 || pipe(p2) < 0){
+      printf("ctxbench: pipe failed\n");
+      exit(1);
+    }
+    // fault the pages in, so the rounds only measure switching.
+    touch(npages);
+    t0 = uptime();
+    if((pid = fork()) < 0){
+      printf("ctxbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      // the child's copy-on-write pages are copied on the
+      // first round, but that is the same for every run.
+      pingpong(p1[0], p2[1], npages, 0);
+      exit(0);
+    }
+    pingpong(p2[0], p1[1], npages, 1);
+    wait(&xstatus);
+    t1 = uptime();
+    if(xstatus != 0)
+      exit(1);
+    printf("%d\t%d\t%d\n", npages, t1 - t0, ROUNDS);
+    close(p1[0]); close(p1[1]);
+    close(p2[0]); close(p2[1]);
+  }
+  exit(0);
+}
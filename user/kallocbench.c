@@ -0,0 +1,95 @@
+// Page allocator contention benchmark.
+// Runs 1, 2, ... up to maxharts children that each repeatedly
+// grow and shrink their heap, touching every page, and reports
+// elapsed ticks and the kmem lock counters for each run.
+// Run with as many harts as you test, e.g. make CPUS=8 qemu.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+#define NPAGES  64   // pages each child allocates per round
+#define ROUNDS 200
+#define NSTAT   32
+
+struct lockstat stats[NSTAT];
+
+// sum the counters of the per-CPU allocator locks.
+void
+kmemstat(uint64 *n, uint64 *nts)
+{
+  int i, cnt;
+
+  if((cnt = lockstat(stats, NSTAT)) < 0){
+    printf("kallocbench: lockstat failed\n");
+    exit(1);
+  }
+  *n = *nts = 0;
+  for(i = 0; i < cnt; i++){
+    if(memcmp(stats[i].name, "kmem", 4) == 0){
+      *n += stats[i].n;
+      *nts += stats[i].nts;
+    }
+  }
+}
+
+void
+worker(void)
+{
+  int r, i;
+  char *a;
+
+  for(r = 0; r < ROUNDS; r++){
+    a = sbrk(NPAGES*PGSIZE);
+    if(a == (char*)-1){
+      printf("kallocbench: sbrk failed\n");
+      exit(1);
+    }
+    for(i = 0; i < NPAGES; i++)
+      a[i*PGSIZE] = r;
+    sbrk(-(NPAGES*PGSIZE));
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxharts = NCPU;
+  int n, i, t0, t1;
+  uint64 n0, nts0, n1, nts1;
+
+  if(argc > 1)
+    maxharts = atoi(argv[1]);
+  if(maxharts < 1 || maxharts > NCPU){
+    fprintf(2, "usage: kallocbench [harts<=%d]\n", NCPU);
+    exit(1);
+  }
+
+  printf("harts\tticks\tacquires\tcontended spins\n");
+  for(n = 1; n <= maxharts; n++){
+    kmemstat(&n0, &nts0);
+    t0 = uptime();
+    for(i = 0; i < n; i++){
+      int pid = fork();
+      if(pid < 0){
+        printf("kallocbench: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0)
+        worker();
+    }
+    for(i = 0; i < n; i++){
+      int xstatus;
+      wait(&xstatus);
+      if(xstatus != 0)
+        exit(1);
+    }
+    t1 = uptime();
+    kmemstat(&n1, &nts1);
+    printf("%d\t%d\t%l\t%l\n", n, t1 - t0, n1 - n0, nts1 - nts0);
+  }
+  exit(0);
+}
@@ -0,0 +1,135 @@
+// Tests for lazy heap allocation.
+// Grows the heap far beyond what it touches, checks that only
+// touched pages use memory, that untouched pages read as zero,
+// and that system calls can read and write untouched pages.
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/fcntl.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define BIG (64*1024*1024)
+
+uint64
+freemem(void)
+{
+  struct sysinfo info;
+
+  if(sysinfo(&info) < 0){
+    printf("lazytest: sysinfo failed\n");
+    exit(1);
+  }
+  return info.freemem;
+}
+
+// sbrk a large heap and touch every 256th page.
+void
+sparse(void)
+{
+  uint64 before, after;
+  char *start, *p;
+
+  printf("sparse: ");
+  before = freemem();
+  start = sbrk(BIG);
+  if(start == (char*)-1){
+    printf("sbrk failed\n");
+    exit(1);
+  }
+  for(p = start; p < start + BIG; p += 256*PGSIZE){
+    if(*p != 0){
+      printf("untouched page not zero\n");
+      exit(1);
+    }
+    *p = 1;
+  }
+  after = freemem();
+  // 64 touched pages, 33 page-table pages, and slack for
+  // other allocations.
+  if(before - after > 128*PGSIZE){
+    printf("%d pages used, expected about %d\n",
+           (int)((before - after) / PGSIZE), BIG / (256*PGSIZE));
+    exit(1);
+  }
+  sbrk(-BIG);
+  // the page-table pages stay until exit.
+  if(freemem() < before - 40*PGSIZE){
+    printf("memory not freed\n");
+    exit(1);
+  }
+  printf("ok\n");
+}
+
+// read() into, and write() from, heap pages never touched
+// by user code.
+void
+syscalls(void)
+{
+  char *a, *b;
+  int fd, i;
+
+  printf("syscalls: ");
+  a = sbrk(2*PGSIZE);
+  b = a + PGSIZE;
+  if(a == (char*)-1){
+    printf("sbrk failed\n");
+    exit(1);
+  }
+  fd = open("lazytest.tmp", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, a, PGSIZE) != PGSIZE){
+    printf("write from untouched page failed\n");
+    exit(1);
+  }
+  close(fd);
+  fd = open("lazytest.tmp", O_RDONLY);
+  if(fd < 0 || read(fd, b, PGSIZE) != PGSIZE){
+    printf("read into untouched page failed\n");
+    exit(1);
+  }
+  close(fd);
+  unlink("lazytest.tmp");
+  for(i = 0; i < PGSIZE; i++){
+    if(b[i] != 0){
+      printf("wrong data\n");
+      exit(1);
+    }
+  }
+  sbrk(-2*PGSIZE);
+  printf("ok\n");
+}
+
+// a child that touches memory beyond its heap is killed.
+void
+outofrange(void)
+{
+  int pid, xstatus;
+
+  printf("outofrange: ");
+  pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    char *p = sbrk(0) + 16*PGSIZE;
+    *p = 1;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("child was not killed\n");
+    exit(1);
+  }
+  printf("ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  sparse();
+  syscalls();
+  outofrange();
+  printf("ALL LAZY TESTS PASSED\n");
+  exit(0);
+}
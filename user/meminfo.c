@@ -0,0 +1,56 @@
+// Print the kernel's memory use, like /proc/meminfo.
+
+#include "kernel/types.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+// names of the KM_ tags, in order.
+char *tagnames[] = {
+  "Other:",
+  "User:",
+  "PageTables:",
+  "KernelStack:",
+  "Trapframes:",
+  "Slab:",
+  "Devices:",
+};
+
+void
+show(char *name, uint64 bytes)
+{
+  int n = strlen(name);
+
+  printf("%s", name);
+  while(n++ < 16)
+    printf(" ");
+  printf("%l kB\n", bytes / 1024);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct sysinfo_ext info;
+  int i;
+
+  if(sysinfo_ext(&info, sizeof(info)) < 0){
+    fprintf(2, "meminfo: sysinfo_ext failed\n");
+    exit(1);
+  }
+  if(info.version != SYSINFO_VERSION)
+    fprintf(2, "meminfo: kernel has sysinfo version %d, expected %d\n",
+            info.version, SYSINFO_VERSION);
+
+  show("MemTotal:", info.totalmem);
+  show("MemFree:", info.freemem);
+  show("ZeroPool:", info.zeropool);
+  for(i = 0; i < info.ntags && i < NKMTAG; i++)
+    show(tagnames[i], info.tagmem[i]);
+  if(info.version >= 2)
+    show("AnonHugePages:", info.hugepages);
+  show("SwapTotal:", info.swaptotal);
+  show("SwapFree:", info.swaptotal - info.swapused);
+  printf("SwapIn:         %l pages\n", info.nswapin);
+  printf("SwapOut:        %l pages\n", info.nswapout);
+  printf("Processes:      %l\n", info.nproc);
+  exit(0);
+}
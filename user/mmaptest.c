@@ -0,0 +1,204 @@
+// Tests for mmap() and munmap().
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NPAGES 4
+
+char buf[PGSIZE];
+
+void
+err(char *why)
+{
+  printf("mmaptest: %s failed\n", why);
+  exit(1);
+}
+
+// create a file of NPAGES pages, page i filled with 'a'+i.
+void
+makefile(char *name)
+{
+  int fd, i;
+
+  unlink(name);
+  if((fd = open(name, O_CREATE|O_RDWR)) < 0)
+    err("create");
+  for(i = 0; i < NPAGES; i++){
+    memset(buf, 'a' + i, PGSIZE);
+    if(write(fd, buf, PGSIZE) != PGSIZE)
+      err("write");
+  }
+  close(fd);
+}
+
+void
+privatetest(void)
+{
+  char *p;
+  int fd, i;
+
+  printf("private: ");
+  makefile("mmap.tmp");
+  if((fd = open("mmap.tmp", O_RDONLY)) < 0)
+    err("open");
+  p = mmap(0, NPAGES*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1)
+    err("mmap");
+  close(fd);
+  for(i = 0; i < NPAGES*PGSIZE; i++)
+    if(p[i] != 'a' + i/PGSIZE)
+      err("private read");
+  // private writes never reach the file.
+  p[0] = 'z';
+  if(munmap(p, NPAGES*PGSIZE) < 0)
+    err("munmap");
+  fd = open("mmap.tmp", O_RDONLY);
+  if(read(fd, buf, 1) != 1 || buf[0] != 'a')
+    err("private isolation");
+  close(fd);
+  printf("ok\n");
+}
+
+void
+sharedtest(void)
+{
+  char *p;
+  int fd;
+
+  printf("shared: ");
+  makefile("mmap.tmp");
+  if((fd = open("mmap.tmp", O_RDWR)) < 0)
+    err("open");
+  p = mmap(0, NPAGES*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1)
+    err("mmap");
+  close(fd);
+  p[0] = 'x';
+  p[2*PGSIZE] = 'y';
+  // unmap the first two pages, then the rest.
+  if(munmap(p, 2*PGSIZE) < 0 || munmap(p + 2*PGSIZE, 2*PGSIZE) < 0)
+    err("munmap");
+  fd = open("mmap.tmp", O_RDONLY);
+  if(read(fd, buf, 1) != 1 || buf[0] != 'x')
+    err("write back page 0");
+  read(fd, buf, PGSIZE - 1);
+  read(fd, buf, PGSIZE);
+  if(read(fd, buf, 1) != 1 || buf[0] != 'y')
+    err("write back page 2");
+  close(fd);
+
+  // a read-only file cannot be mapped shared and writable.
+  fd = open("mmap.tmp", O_RDONLY);
+  if(mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != (char*)-1)
+    err("permission check");
+  close(fd);
+  printf("ok\n");
+}
+
+// writes by the kernel, here by read(), must reach the file
+// too, though they do not go through the user page table.
+void
+kernelwritetest(void)
+{
+  char *p;
+  int fd;
+
+  printf("kernel write: ");
+  makefile("mmap.tmp");
+  if((fd = open("mmap.tmp", O_RDWR)) < 0)
+    err("open");
+  p = mmap(0, NPAGES*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1)
+    err("mmap");
+  close(fd);
+  // read page 3 of the file into page 0 of the mapping, which
+  // the process itself never touches.
+  fd = open("mmap.tmp", O_RDONLY);
+  read(fd, buf, PGSIZE);
+  read(fd, buf, PGSIZE);
+  read(fd, buf, PGSIZE);
+  if(read(fd, p, PGSIZE) != PGSIZE)
+    err("read into mapping");
+  close(fd);
+  if(munmap(p, NPAGES*PGSIZE) < 0)
+    err("munmap");
+  fd = open("mmap.tmp", O_RDONLY);
+  if(read(fd, buf, PGSIZE) != PGSIZE || buf[0] != 'd' || buf[PGSIZE-1] != 'd')
+    err("write back of read()");
+  close(fd);
+  printf("ok\n");
+}
+
+void
+holetest(void)
+{
+  char *p;
+  int fd;
+
+  printf("hole: ");
+  makefile("mmap.tmp");
+  fd = open("mmap.tmp", O_RDONLY);
+  p = mmap(0, NPAGES*PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1)
+    err("mmap");
+  close(fd);
+  // punch a hole in the middle, splitting the mapping.
+  if(munmap(p + PGSIZE, PGSIZE) < 0)
+    err("munmap");
+  if(p[0] != 'a' || p[2*PGSIZE] != 'c' || p[3*PGSIZE] != 'd')
+    err("read around hole");
+  munmap(p, NPAGES*PGSIZE);
+  unlink("mmap.tmp");
+  printf("ok\n");
+}
+
+void
+anontest(void)
+{
+  int *shared, *private, pid, xstatus;
+
+  printf("anonymous: ");
+  shared = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  private = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(shared == (int*)-1 || private == (int*)-1)
+    err("mmap");
+  if(*shared != 0 || *private != 0)
+    err("zero fill");
+  *shared = 1;
+  *private = 1;
+  pid = fork();
+  if(pid < 0)
+    err("fork");
+  if(pid == 0){
+    if(*shared != 1 || *private != 1)
+      exit(1);
+    *shared = 2;
+    *private = 2;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    err("child view");
+  if(*shared != 2)
+    err("shared after fork");
+  if(*private != 1)
+    err("private after fork");
+  munmap(shared, PGSIZE);
+  munmap(private, PGSIZE);
+  printf("ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  privatetest();
+  sharedtest();
+  kernelwritetest();
+  holetest();
+  anontest();
+  printf("ALL MMAP TESTS PASSED\n");
+  exit(0);
+}
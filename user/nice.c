@@ -0,0 +1,26 @@
+// Run a command at a lower scheduling priority:
+// nice level command [args...]
+// level is the highest MLFQ level the command and its
+// children may run at, 0 to NPRIO-1; NPRIO-1 keeps batch work
+// out of the way of interactive processes. Has no effect
+// unless the kernel is built with SCHEDPOLICY=MLFQ.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  if(argc < 3){
+    fprintf(2, "usage: nice level command [args...]\n");
+    exit(1);
+  }
+  if(setpriority(getpid(), atoi(argv[1])) < 0){
+    fprintf(2, "nice: level must be 0 to %d\n", NPRIO - 1);
+    exit(1);
+  }
+  exec(argv[2], argv + 2);
+  fprintf(2, "nice: exec %s failed\n", argv[2]);
+  exit(1);
+}
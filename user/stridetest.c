@@ -0,0 +1,103 @@
+// Test of stride scheduling.
+// Runs CPU-bound children with 1, 2 and 3 times as many
+// tickets side by side for DURATION ticks, and compares how
+// much work each got done, which should be in proportion to
+// its tickets. Run with one hart and the stride scheduler,
+// make CPUS=1 SCHEDPOLICY=STRIDE qemu, so that the children
+// really share a hart.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define NCHILD   3
+#define DURATION 50      // ticks
+#define SLACK    5       // allowed error, as 1/SLACK of the expected ratio
+
+int tickets[NCHILD] = { 100, 200, 300 };
+
+struct result {
+  int child;
+  uint64 count;
+};
+
+// spin until DURATION ticks after the start byte arrives,
+// then report how many loops that took.
+void
+spin(int child, int start, int done)
+{
+  struct result r;
+  char c;
+  int t0;
+
+  if(settickets(tickets[child]) < 0){
+    printf("stridetest: settickets failed\n");
+    exit(1);
+  }
+  if(read(start, &c, 1) != 1){
+    printf("stridetest: read failed\n");
+    exit(1);
+  }
+  r.child = child;
+  r.count = 0;
+  t0 = uptime();
+  for(;;){
+    r.count++;
+    if((r.count & 0xfff) == 0 && uptime() - t0 >= DURATION)
+      break;
+  }
+  if(write(done, &r, sizeof(r)) != sizeof(r)){
+    printf("stridetest: write failed\n");
+    exit(1);
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int start[2], done[2], i, failed = 0;
+  uint64 count[NCHILD], expect, got;
+  struct result r;
+  char go[NCHILD];
+
+  if(pipe(start) < 0 || pipe(done) < 0){
+    printf("stridetest: pipe failed\n");
+    exit(1);
+  }
+  for(i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("stridetest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      spin(i, start[0], done[1]);
+  }
+  memset(go, 0, sizeof(go));
+  write(start[1], go, sizeof(go));
+  for(i = 0; i < NCHILD; i++){
+    if(read(done[0], &r, sizeof(r)) != sizeof(r)){
+      printf("stridetest: read failed\n");
+      exit(1);
+    }
+    count[r.child] = r.count;
+  }
+  for(i = 0; i < NCHILD; i++)
+    wait(0);
+
+  // ratios to the first child, in percent.
+  printf("tickets\tloops\tratio\texpected\n");
+  for(i = 0; i < NCHILD; i++){
+    expect = tickets[i] * 100 / tickets[0];
+    got = count[0] ? count[i] * 100 / count[0] : 0;
+    printf("%d\t%l\t%l%%\t%l%%\n", tickets[i], count[i], got, expect);
+    if(got + expect / SLACK < expect || got > expect + expect / SLACK)
+      failed = 1;
+  }
+  if(failed){
+    printf("stridetest: ratios off by more than 1/%d\n", SLACK);
+    exit(1);
+  }
+  printf("stridetest: OK\n");
+  exit(0);
+}
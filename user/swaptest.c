@@ -0,0 +1,88 @@
+// Tests for swapping.
+// Touches more memory than the machine has, which only works
+// if pages are swapped out, and checks that every page comes
+// back with what was written to it, also in a forked child.
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define EXTRA (16*1024*1024)   // beyond free memory
+
+struct sysinfo
+info(void)
+{
+  struct sysinfo info;
+
+  if(sysinfo(&info) < 0){
+    printf("swaptest: sysinfo failed\n");
+    exit(1);
+  }
+  return info;
+}
+
+// check every step'th of npages pages at start.
+int
+check(char *start, int npages, int step)
+{
+  for(int i = 0; i < npages; i += step)
+    if(*(int*)(start + (uint64)i*PGSIZE) != i)
+      return -1;
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct sysinfo before, after;
+  int npages, pid, xstatus;
+  char *start;
+
+  printf("overcommit: ");
+  before = info();
+  npages = (before.freemem + EXTRA) / PGSIZE;
+  start = sbrk(npages*PGSIZE);
+  if(start == (char*)-1){
+    printf("sbrk failed\n");
+    exit(1);
+  }
+  for(int i = 0; i < npages; i++)
+    *(int*)(start + (uint64)i*PGSIZE) = i;
+  if(check(start, npages, 1) < 0){
+    printf("page lost its contents\n");
+    exit(1);
+  }
+  after = info();
+  if(after.nswapout - before.nswapout < EXTRA/PGSIZE ||
+     after.nswapin == before.nswapin){
+    printf("%d pages swapped out, %d in\n",
+           (int)(after.nswapout - before.nswapout),
+           (int)(after.nswapin - before.nswapin));
+    exit(1);
+  }
+  printf("ok\n");
+
+  printf("fork: ");
+  pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(1);
+  }
+  if(pid == 0)
+    exit(check(start, npages, 16) < 0);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("child saw wrong contents\n");
+    exit(1);
+  }
+  if(check(start, npages, 16) < 0){
+    printf("parent saw wrong contents\n");
+    exit(1);
+  }
+  printf("ok\n");
+
+  sbrk(-npages*PGSIZE);
+  printf("ALL SWAP TESTS PASSED\n");
+  exit(0);
+}
@@ -1,5 +1,8 @@
 struct stat;
 struct sysinfo;
+struct sysinfo_ext;
+struct lockstat;
+struct cpustat;
 
 // system calls
 int fork(void);
@@ -25,6 +28,14 @@ int sleep(int);
 int uptime(void);
 int trace(int);
 int sysinfo(struct sysinfo *);
+int lockstat(struct lockstat *, int);
+void *mmap(void *, int, int, int, int, int);
+int munmap(void *, int);
+int sysinfo_ext(struct sysinfo_ext *, int);
+int cpustat(struct cpustat *, int);
+int setpriority(int, int);
+int getpriority(int);
+int settickets(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -785,6 +785,58 @@ pipe1(char *s)
   }
 }
 
+// several readers blocked on a pipe must all see end of file
+// when the writer closes, including one that waited for
+// another reader's copy out.
+void
+pipeeof(char *s)
+{
+  enum { NREADER=2 };
+  int fds[2], pid, xstatus, i, n, total;
+  char c;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NREADER; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork() failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[1]);
+      total = 0;
+      while((n = read(fds[0], buf, sizeof(buf))) > 0)
+        total += n;
+      exit(n < 0 ? -1 : total);
+    }
+  }
+  close(fds[0]);
+  // let the readers block, then give one of them a byte and
+  // close while it may still be copying it out.
+  sleep(1);
+  c = 'x';
+  if(write(fds[1], &c, 1) != 1){
+    printf("%s: pipe write failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  total = 0;
+  for(i = 0; i < NREADER; i++){
+    wait(&xstatus);
+    if(xstatus < 0){
+      printf("%s: reader failed\n", s);
+      exit(1);
+    }
+    total += xstatus;
+  }
+  if(total != 1){
+    printf("%s: readers got %d bytes, not 1\n", s, total);
+    exit(1);
+  }
+}
 
 // test if child is killed (status = -1)
 void
@@ -2594,6 +2646,7 @@ struct test {
   {dirtest, "dirtest"},
   {exectest, "exectest"},
   {pipe1, "pipe1"},
+  {pipeeof, "pipeeof"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
@@ -38,3 +38,11 @@ entry("sleep");
 entry("uptime");
 entry("trace");
 entry("sysinfo");
+entry("lockstat");
+entry("mmap");
+entry("munmap");
+entry("sysinfo_ext");
+entry("cpustat");
+entry("setpriority");
+entry("getpriority");
+entry("settickets");
@@ -0,0 +1,66 @@
+// Wakeup latency benchmark.
+// A parent and a child pass a byte back and forth over two
+// pipes for DURATION ticks, and report the mean round trip.
+// Each side sleeps in read() until the other writes, so every
+// round trip is two wakeups; with more than one hart, the
+// woken process mostly runs on a hart that is idle, so the
+// time is mostly how long that hart takes to notice. Run with
+// several harts, make CPUS=3 qemu, and see cpustat for where
+// the processes ran.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define DURATION  20       // ticks
+#define USPERTICK 100000   // TICKCYCLES at qemu's 10 MHz timer
+
+int
+main(int argc, char *argv[])
+{
+  int p1[2], p2[2], pid, t0, t1, xstatus;
+  uint64 rounds = 0;
+  char c;
+
+  if(pipe(p1) < 0 || pipe(p2) < 0){
+    printf("wakebench: pipe failed\n");
+    exit(1);
+  }
+  if((pid = fork()) < 0){
+    printf("wakebench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    // echo until the parent sends 1.
+    for(;;){
+      if(read(p1[0], &c, 1) != 1){
+        printf("wakebench: read failed\n");
+        exit(1);
+      }
+      if(c)
+        exit(0);
+      if(write(p2[1], &c, 1) != 1){
+        printf("wakebench: write failed\n");
+        exit(1);
+      }
+    }
+  }
+
+  t0 = uptime();
+  do {
+    c = 0;
+    if(write(p1[1], &c, 1) != 1 || read(p2[0], &c, 1) != 1){
+      printf("wakebench: pipe i/o failed\n");
+      exit(1);
+    }
+    rounds++;
+  } while((t1 = uptime()) - t0 < DURATION);
+  c = 1;
+  write(p1[1], &c, 1);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+
+  printf("%l round trips in %d ticks: %l us each\n", rounds, t1 - t0,
+         (uint64)(t1 - t0) * USPERTICK / rounds);
+  exit(0);
+}